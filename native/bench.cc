@@ -0,0 +1,402 @@
+#include "vm_app.h"
+#include "harness.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+using namespace std;
+
+/**********
+bench: workload generator for the native harness, the application every process runs
+	BENCH_WORKLOAD picks the access pattern (default uniform):
+		seq      pages in order, BENCH_RUN accesses to each before the next (default 16)
+		loop     pages in order, one access each, over and over: a loop larger than memory
+			defeats LRU-like policies
+		uniform  pages uniformly at random
+		zipf     pages by a Zipf distribution of skew BENCH_ZIPF (default 0.99), the ranks
+			scattered over the arena
+		fork     uniform accesses, and every BENCH_FORK accesses (default 1000) a child that
+			makes BENCH_CHILD accesses (default 64) to the copy-on-write arena and exits
+		syslog   uniform accesses, each also writing a short line into the page and
+			vm_syslog'ing it, one in eight spanning two pages
+		release  uniform accesses to the valid pages, and every BENCH_RELEASE accesses (default
+			500) a vm_advise or vm_release of up to 8 pages: a release in the middle leaves
+			a hole, one at the top shrinks the arena until the next time, which extends it
+			back to BENCH_PAGES pages that must read as zeros; DONTNEED zeros the range, and
+			a range over a hole must fail
+	BENCH_PAGES: arena pages of a process (default 256)
+	BENCH_OPS: accesses per process (default 100000)
+	BENCH_WRITES: percent of the accesses that write (default 30)
+	BENCH_YIELD: accesses between vm_yield calls (default 1000)
+	BENCH_SEED: seed of the first process, the others get the next ones (default 1)
+	BENCH_QUOTA: "min,max" sets that quota (vm_set_quota) on every process at its start, which
+		must succeed; at each vm_yield its resident frames (vm_resident) must be at most max,
+		and after it no fewer than min or than before it (other processes do not take frames
+		from it at min), and its working set (vm_working_set) between 0 and BENCH_PAGES;
+		the disk must hold every page, a process with no free block may pass max (default:
+		no quota, no checks)
+
+a write stores a new stamp in the word at STAMP_OFFSET of its page, and every access checks
+that word against the stamp the process wrote last, so a pager losing data fails the run
+**********/
+
+#define STAMP_OFFSET (VM_PAGESIZE / 2)
+#define LINE_SIZE 64
+#define RESHAPE_PAGES 8
+#define HOLE 0xffffffffu	// the stamp of a released page
+
+enum { SEQ, LOOP, UNIFORM, ZIPF, FORK, SYSLOG, RELEASE };
+const char *workload_names[] = { "seq", "loop", "uniform", "zipf", "fork", "syslog", "release" };
+
+typedef struct {
+	char *base;
+	unsigned int pages;
+	unsigned int *stamps;	// last stamp written to each page, 0 if never
+	unsigned int next_stamp;
+	unsigned long long rng;
+} bench_state;
+
+int workload = UNIFORM;
+unsigned int pages = 256;
+unsigned long ops = 100000;
+unsigned int writes = 30;
+unsigned int yield_every = 1000;
+unsigned int run_length = 16;
+unsigned int fork_every = 1000;
+unsigned int child_ops = 64;
+unsigned int release_every = 500;
+double zipf_skew = 0.99;
+unsigned int next_seed = 1;
+bool quota;
+unsigned int quota_min, quota_max;
+double *zipf_cdf;
+bool configured;
+
+unsigned int
+env_uint(const char *name, unsigned int fallback)
+{
+	const char *value = getenv(name);
+	return value ? strtoul(value, 0, 0) : fallback;
+}
+
+void
+read_config()
+{
+	configured = true;
+	const char *name = getenv("BENCH_WORKLOAD");
+	for (unsigned int i = 0; name && i < sizeof(workload_names) / sizeof(*workload_names); i++) {
+		if (!strcmp(name, workload_names[i])) {
+			workload = i;
+		}
+	}
+	pages = env_uint("BENCH_PAGES", pages);
+	ops = env_uint("BENCH_OPS", ops);
+	writes = env_uint("BENCH_WRITES", writes);
+	yield_every = env_uint("BENCH_YIELD", yield_every);
+	run_length = env_uint("BENCH_RUN", run_length);
+	fork_every = env_uint("BENCH_FORK", fork_every);
+	child_ops = env_uint("BENCH_CHILD", child_ops);
+	release_every = env_uint("BENCH_RELEASE", release_every);
+	next_seed = env_uint("BENCH_SEED", next_seed);
+	const char *q = getenv("BENCH_QUOTA");
+	quota = q && sscanf(q, "%u,%u", &quota_min, &quota_max) == 2;
+	const char *skew = getenv("BENCH_ZIPF");
+	zipf_skew = skew ? atof(skew) : zipf_skew;
+	if (workload == ZIPF) {
+		zipf_cdf = (double *)malloc(pages * sizeof(double));
+		double sum = 0;
+		for (unsigned int i = 0; i < pages; i++) {
+			sum += 1 / pow(i + 1, zipf_skew);
+			zipf_cdf[i] = sum;
+		}
+		for (unsigned int i = 0; i < pages; i++) {
+			zipf_cdf[i] /= sum;
+		}
+	}
+}
+
+// xorshift64*
+unsigned long long
+next_random(bench_state *s)
+{
+	s->rng ^= s->rng >> 12;
+	s->rng ^= s->rng << 25;
+	s->rng ^= s->rng >> 27;
+	return s->rng * 2685821657736338717ULL;
+}
+
+unsigned int
+zipf_page(bench_state *s)
+{
+	double u = (next_random(s) >> 11) * (1.0 / 9007199254740992.0);
+	unsigned int lo = 0, hi = pages - 1;
+	while (lo < hi) {
+		unsigned int mid = (lo + hi) / 2;
+		if (zipf_cdf[mid] < u) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	// scatter the ranks so the hot pages do not share swap runs
+	return (unsigned long long)lo * 40503 % pages;
+}
+
+void
+check_page(bench_state *s, unsigned int page)
+{
+	unsigned int found = *(unsigned int *)(s->base + (size_t)page * VM_PAGESIZE + STAMP_OFFSET);
+	if (found != s->stamps[page]) {
+		fprintf(stderr, "bench: page %u holds stamp %u, expected %u\n", page, found, s->stamps[page]);
+		abort();
+	}
+}
+
+void
+access_page(bench_state *s, unsigned int page)
+{
+	check_page(s, page);
+	if (next_random(s) % 100 < writes) {
+		s->stamps[page] = ++s->next_stamp;
+		*(unsigned int *)(s->base + (size_t)page * VM_PAGESIZE + STAMP_OFFSET) = s->stamps[page];
+	}
+}
+
+// write a line at a random offset of page, away from its stamp, and log it; some lines cross
+// into the next page
+void
+syslog_page(bench_state *s, unsigned int page)
+{
+	char line[LINE_SIZE];
+	int len = snprintf(line, sizeof(line), "bench %u", s->next_stamp);
+	unsigned int offset = next_random(s) % (STAMP_OFFSET - LINE_SIZE);
+	if (next_random(s) % 8 == 0 && page + 1 < s->pages) {
+		offset = VM_PAGESIZE - len / 2;
+		check_page(s, page + 1);
+	}
+	check_page(s, page);
+	char *message = s->base + (size_t)page * VM_PAGESIZE + offset;
+	memcpy(message, line, len);
+	vm_syslog(message, len);
+}
+
+// a random page that is not a hole
+unsigned int
+valid_page(bench_state *s)
+{
+	unsigned int page;
+	do {
+		page = next_random(s) % s->pages;
+	} while (s->stamps[page] == HOLE);
+	return page;
+}
+
+void
+fail_call(const char *call, unsigned int first, unsigned int count, int result)
+{
+	fprintf(stderr, "bench: %s of pages %u-%u returned %d\n", call, first, first + count - 1, result);
+	abort();
+}
+
+// extend the arena back to s->pages after a release at the top lowered it past every trailing hole
+void
+extend_back(bench_state *s)
+{
+	unsigned int valid_top = s->pages;
+	while (valid_top > 0 && s->stamps[valid_top - 1] == HOLE) {
+		valid_top--;
+	}
+	char *extended = (char *)vm_extend_n(s->pages - valid_top);
+	if (extended != s->base + (size_t)valid_top * VM_PAGESIZE) {
+		fprintf(stderr, "bench: vm_extend_n(%u) after a release returned %p, expected %p\n",
+			s->pages - valid_top, extended, s->base + (size_t)valid_top * VM_PAGESIZE);
+		abort();
+	}
+	for (unsigned int page = valid_top; page < s->pages; page++) {
+		s->stamps[page] = 0;
+		check_page(s, page);
+	}
+}
+
+// vm_advise or vm_release a random range, and check the pages around and in it afterwards
+void
+reshape(bench_state *s)
+{
+	if (s->stamps[s->pages - 1] == HOLE) {
+		extend_back(s);
+		return;
+	}
+	if (s->pages < 2) {
+		return;
+	}
+	// at most half the arena, so valid_page always has a page to pick
+	unsigned int limit = s->pages / 2 < RESHAPE_PAGES ? s->pages / 2 : RESHAPE_PAGES;
+	unsigned int first = next_random(s) % s->pages;
+	unsigned int count = 1 + next_random(s) % limit;
+	unsigned int holes = 0;
+	for (unsigned int page = 0; page < s->pages; page++) {
+		holes += s->stamps[page] == HOLE;
+	}
+	bool top = next_random(s) % 2;
+	if (top || holes + count > s->pages / 4) {
+		first = s->pages - count;
+	} else if (count > s->pages - first) {
+		count = s->pages - first;
+	}
+	bool valid = true;
+	for (unsigned int page = first; page < first + count; page++) {
+		valid = valid && s->stamps[page] != HOLE;
+	}
+	char *addr = s->base + (size_t)first * VM_PAGESIZE;
+	int result;
+	if (next_random(s) % 2) {
+		int advice = next_random(s) % (VM_ADVICE_DONTNEED + 1);
+		result = vm_advise(addr, count, advice);
+		if (result != (valid ? 0 : -1)) {
+			fail_call("vm_advise", first, count, result);
+		}
+		for (unsigned int page = first; valid && page < first + count; page++) {
+			if (advice == VM_ADVICE_DONTNEED) {
+				s->stamps[page] = 0;
+			}
+			check_page(s, page);
+		}
+		return;
+	}
+	result = vm_release(addr, count);
+	if (result != (valid ? 0 : -1)) {
+		fail_call("vm_release", first, count, result);
+	}
+	if (!valid) {
+		return;
+	}
+	for (unsigned int page = first; page < first + count; page++) {
+		s->stamps[page] = HOLE;
+	}
+	if (first > 0 && s->stamps[first - 1] != HOLE) {
+		check_page(s, first - 1);
+	}
+	if (first + count < s->pages && s->stamps[first + count] != HOLE) {
+		check_page(s, first + count);
+	}
+}
+
+bench_state *
+copy_state(bench_state *s)
+{
+	bench_state *copy = (bench_state *)malloc(sizeof(bench_state));
+	*copy = *s;
+	copy->stamps = (unsigned int *)malloc(s->pages * sizeof(unsigned int));
+	memcpy(copy->stamps, s->stamps, s->pages * sizeof(unsigned int));
+	copy->rng = next_random(s) | 1;
+	return copy;
+}
+
+void
+free_state(bench_state *s)
+{
+	free(s->stamps);
+	free(s);
+}
+
+// BENCH_QUOTA: check the process against its quota, held is what it had before it yielded
+// (-1 for none); returns what it has now
+int
+check_quota(int held)
+{
+	int resident = harness_resident();
+	int working_set = harness_working_set();
+	if (resident < 0 || (quota_max && (unsigned int)resident > quota_max)) {
+		fprintf(stderr, "bench: %d frames resident, quota %u,%u\n", resident, quota_min, quota_max);
+		abort();
+	}
+	if (held >= 0 && resident < min(held, (int)quota_min)) {
+		fprintf(stderr, "bench: %d frames resident after a yield, %d before, quota %u,%u\n",
+			resident, held, quota_min, quota_max);
+		abort();
+	}
+	if (working_set < 0 || (unsigned int)working_set > pages) {
+		fprintf(stderr, "bench: working set %d of %u pages\n", working_set, pages);
+		abort();
+	}
+	return resident;
+}
+
+void
+child_main(void *arg)
+{
+	bench_state *s = (bench_state *)arg;
+	for (unsigned int i = 0; i < child_ops; i++) {
+		access_page(s, next_random(s) % s->pages);
+	}
+	free_state(s);
+}
+
+int
+main()
+{
+	if (!configured) {
+		read_config();
+	}
+	bench_state state;
+	bench_state *s = &state;
+	s->pages = pages;
+	s->stamps = (unsigned int *)calloc(pages, sizeof(unsigned int));
+	s->next_stamp = 0;
+	s->rng = 0x9e3779b97f4a7c15ULL * next_seed++;
+	s->base = (char *)vm_extend_n(pages);
+	if (!s->base) {
+		fprintf(stderr, "bench: vm_extend_n(%u) failed\n", pages);
+		return 1;
+	}
+	if (quota && harness_set_quota(quota_min, quota_max)) {
+		fprintf(stderr, "bench: vm_set_quota(%u, %u) failed\n", quota_min, quota_max);
+		return 1;
+	}
+	unsigned int page = 0, run = 0;
+	for (unsigned long i = 0; i < ops; i++) {
+		switch (workload) {
+		case SEQ:
+			if (++run >= run_length) {
+				run = 0;
+				page = (page + 1) % pages;
+			}
+			break;
+		case LOOP:
+			page = (page + 1) % pages;
+			break;
+		case ZIPF:
+			page = zipf_page(s);
+			break;
+		case RELEASE:
+			page = valid_page(s);
+			break;
+		default:
+			page = next_random(s) % pages;
+			break;
+		}
+		access_page(s, page);
+		if (workload == SYSLOG) {
+			syslog_page(s, page);
+		}
+		if (workload == RELEASE && i % release_every == release_every - 1) {
+			reshape(s);
+		}
+		if (workload == FORK && i % fork_every == fork_every - 1) {
+			bench_state *copy = copy_state(s);
+			if (harness_fork(child_main, copy)) {
+				free_state(copy);
+			}
+		}
+		if (yield_every && i % yield_every == yield_every - 1) {
+			int held = quota ? check_quota(-1) : 0;
+			vm_yield();
+			if (quota) {
+				check_quota(held);
+			}
+		}
+	}
+	free(s->stamps);
+	return 0;
+}
@@ -0,0 +1,44 @@
+#!/bin/sh
+# bench.sh [workload...]: run build/bench over a matrix of memory sizes, disk ratios and
+# process counts, one line of results per run
+#	WORKLOADS (default: all of them), MEMORY (memory_pages, default "64 256"),
+#	DISK_RATIO (disk_blocks per memory page, default "4 16") and PROCS (default "1 4") set the
+#	matrix; the BENCH_* variables of bench.cc and the VM_* variables of the pager pass through
+#	BENCH_PAGES defaults to twice the memory over the process count, so memory is overcommitted 2x
+#	fork-oc is the fork workload with VM_OVERCOMMIT=200 and arenas covering 80% of memory and
+#	disk, forking every 200 accesses (BENCH_FORK) and yielding every 37 (BENCH_YIELD): children
+#	share pages past what memory and disk hold; a write may fail for it, a read fault never
+#	may, in any workload
+cd "$(dirname "$0")" || exit 1
+bench=./build/bench
+[ -x $bench ] || { echo "bench.sh: build $bench first (make bench)" >&2; exit 1; }
+
+workloads=${*:-${WORKLOADS:-seq loop uniform zipf fork fork-oc syslog release}}
+printf "%-8s %6s %6s %5s %12s %10s %10s %9s %9s %8s\n" \
+	workload memory disk procs faults/s reads writes p50_us p99_us heap_kb
+for w in $workloads; do
+	workload=$w overcommit=${VM_OVERCOMMIT:-} fork=${BENCH_FORK:-1000} yield=${BENCH_YIELD:-1000}
+	if [ $w = fork-oc ]; then
+		workload=fork overcommit=200 fork=${BENCH_FORK:-200} yield=${BENCH_YIELD:-37}
+	fi
+	for m in ${MEMORY:-64 256}; do
+		for r in ${DISK_RATIO:-4 16}; do
+			for n in ${PROCS:-1 4}; do
+				d=$((m * r))
+				pages=${BENCH_PAGES:-$((2 * m / n))}
+				if [ $w = fork-oc ]; then
+					pages=${BENCH_PAGES:-$((4 * (m + d) / (5 * n)))}
+				fi
+				out=$(BENCH_WORKLOAD=$workload BENCH_PAGES=$pages BENCH_FORK=$fork BENCH_YIELD=$yield \
+					VM_OVERCOMMIT=$overcommit $bench -m $m -d $d -n $n -v 2>&1 >/dev/null) \
+					&& ! echo "$out" | grep -q 'killed, read fault' \
+					|| { echo "$w -m $m -d $d -n $n failed: $out" >&2; exit 1; }
+				line=$(echo "$out" | grep '^harness:')
+				field() { echo "$line" | tr ' ' '\n' | sed -n "s/^$1=//p"; }
+				printf "%-8s %6s %6s %5s %12s %10s %10s %9s %9s %8s\n" $w $m $d $n \
+					$(field faults_per_sec) $(field disk_reads) $(field disk_writes) \
+					$(field fault_p50_us) $(field fault_p99_us) $(field pager_heap_kb)
+			done
+		done
+	done
+done
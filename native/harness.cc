@@ -0,0 +1,578 @@
+#include "vm_pager.h"
+#include "vm_app.h"
+#include "harness.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <vector>
+#include <algorithm>
+#include <deque>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <malloc.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+using namespace std;
+
+/**********
+native harness: a 64-bit stand-in for libvm_pager.a and libvm_app.a, so pager.cc runs (and can
+be profiled) on the build host
+	pm_physmem: memory_pages frames in a memfd, mapped read/write for the pager
+	disk_read/disk_write: pread/pwrite of a disk file, a deleted temporary one unless -f names it
+	MMU: the arena is reserved PROT_NONE at VM_ARENA_BASEADDR; each page whose PTE enables
+		access is mapped onto its frame of the memfd, read-only or read/write.  A shadow copy
+		of the entries mapped so far is compared with page_table_base_register after every
+		call into the pager (mmu_sync), and only the pages that changed are remapped
+	faults: SIGSEGV inside the arena calls vm_fault with the write bit of the x86-64 page
+		fault error code; if vm_fault fails the process is killed, like the infrastructure does
+	processes: -n copies of the application (default 1) run as ucontext coroutines on one
+		thread; vm_yield switches to the next one in a round-robin ready queue.  A process that
+		returns from main is destroyed.  harness_fork (harness.h) adds a vm_fork child, and
+		harness_set_quota, harness_working_set and harness_resident act on the running process
+
+pager.cc is built with its application entry points renamed (pager_vm_extend and so on, see the
+Makefile); the harness defines the application side of them, which calls into the pager and
+syncs the MMU.  Applications are built with main renamed to vm_app_main; one declared with
+arguments gets argc 1 and argv {"app"}.
+
+usage: <app> [-m memory_pages] [-d disk_blocks] [-n processes] [-f disk_file] [-v]
+	-v prints one line of key=value measurements at exit: processes run, faults, faults per
+	second, disk reads and writes, fault latency percentiles, the peak malloc heap in use
+	(the pager's data, sampled), max RSS, remaps, and the time spent in the pager, in mmu_sync
+	and in total
+
+limits: system calls given an arena address see EFAULT instead of faulting, and an
+application calling exit() ends every process
+**********/
+
+// pager.cc is built with -Dvm_extend=pager_vm_extend etc.
+extern void *pager_vm_extend();
+extern void *pager_vm_extend_n(unsigned int count);
+extern int pager_vm_syslog(void *message, unsigned int len);
+extern int pager_vm_release(void *addr, unsigned int npages);
+extern int pager_vm_advise(void *addr, unsigned int npages, int advice);
+
+// the application's main, whichever way it was declared
+extern int vm_app_main() __attribute__((weak));
+extern int vm_app_main(int argc, char **argv) __attribute__((weak));
+extern int vm_app_main(int argc, char const **argv) __attribute__((weak));
+
+void *pm_physmem;
+page_table_t *page_table_base_register;
+
+#define ARENA_PAGES (VM_ARENA_SIZE / VM_PAGESIZE)
+#define STACK_SIZE (1 << 20)
+
+unsigned int memory_pages = 4;
+unsigned int disk_blocks = 1024;
+int physmem_fd = -1;
+int disk_fd = -1;
+
+/**********
+MMU
+	shadow[i]: the entry page i of the arena is mapped by now
+	sync_top: pages [sync_top, ARENA_PAGES) were never valid in any process, so never mapped
+	a changed entry is remapped with mmap (new frame) or mprotect (same frame, other access)
+**********/
+page_table_entry_t shadow[ARENA_PAGES];
+unsigned long sync_top;
+bool table_live;	// page_table_base_register is the running process's, see run_processes
+
+bool
+same_entry(const page_table_entry_t &a, const page_table_entry_t &b)
+{
+	return a.ppage == b.ppage && a.read_enable == b.read_enable && a.write_enable == b.write_enable;
+}
+
+void
+mmu_map(unsigned long page, page_table_entry_t pte)
+{
+	char *addr = (char *)VM_ARENA_BASEADDR + page * VM_PAGESIZE;
+	page_table_entry_t old = shadow[page];
+	bool was_mapped = old.read_enable || old.write_enable;
+	int prot = pte.write_enable ? PROT_READ | PROT_WRITE : pte.read_enable ? PROT_READ : PROT_NONE;
+	if (prot == PROT_NONE) {
+		if (mprotect(addr, VM_PAGESIZE, PROT_NONE)) {
+			perror("mprotect");
+			abort();
+		}
+	} else if (was_mapped && old.ppage == pte.ppage) {
+		if (mprotect(addr, VM_PAGESIZE, prot)) {
+			perror("mprotect");
+			abort();
+		}
+	} else {
+		assert(pte.ppage < memory_pages);
+		if (mmap(addr, VM_PAGESIZE, prot, MAP_SHARED | MAP_FIXED, physmem_fd,
+			(off_t)pte.ppage * VM_PAGESIZE) == MAP_FAILED) {
+			perror("mmap");
+			abort();
+		}
+	}
+	shadow[page] = pte;
+}
+
+struct {
+	unsigned long processes;
+	unsigned long faults;
+	unsigned long remaps;
+	unsigned long disk_reads;
+	unsigned long disk_writes;
+	unsigned long long pager_ns;
+	unsigned long long sync_ns;
+	size_t peak_heap;
+} harness_stats;
+
+unsigned long long
+now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// at vm_switch, vm_extend and every HEAP_SAMPLE faults
+#define HEAP_SAMPLE 256
+
+void
+sample_heap()
+{
+	harness_stats.peak_heap = max(harness_stats.peak_heap, mallinfo2().uordblks);
+}
+
+/**********
+fault latency: log-linear histogram of vm_fault times, LATENCY_SUB buckets per power of two
+	bucket b < LATENCY_SUB holds b ns; above, bucket k * LATENCY_SUB + s holds
+	[(LATENCY_SUB + s) << (k - 1), (LATENCY_SUB + s + 1) << (k - 1))
+**********/
+#define LATENCY_SUB 16
+#define LATENCY_SHIFT 4
+unsigned long latency_buckets[64 * LATENCY_SUB];
+
+void
+record_latency(unsigned long long ns)
+{
+	unsigned int bucket = ns;
+	if (ns >= LATENCY_SUB) {
+		int e = 63 - __builtin_clzll(ns);
+		bucket = (e - LATENCY_SHIFT + 1) * LATENCY_SUB + ((ns >> (e - LATENCY_SHIFT)) & (LATENCY_SUB - 1));
+	}
+	latency_buckets[bucket]++;
+}
+
+// upper bound of the bucket holding the q-th quantile
+unsigned long long
+latency_quantile(double q)
+{
+	unsigned long total = 0;
+	for (unsigned int b = 0; b < 64 * LATENCY_SUB; b++) {
+		total += latency_buckets[b];
+	}
+	unsigned long seen = 0;
+	for (unsigned int b = 0; b < 64 * LATENCY_SUB; b++) {
+		seen += latency_buckets[b];
+		if (seen && seen >= q * total) {
+			if (b < LATENCY_SUB) {
+				return b + 1;
+			}
+			unsigned int k = b / LATENCY_SUB, s = b % LATENCY_SUB;
+			return (unsigned long long)(LATENCY_SUB + s + 1) << (k - 1);
+		}
+	}
+	return 0;
+}
+
+// make the arena mappings match page_table_base_register
+void
+mmu_sync()
+{
+	if (!table_live || !page_table_base_register) {
+		return;
+	}
+	unsigned long long start = now_ns();
+	page_table_entry_t *ptes = page_table_base_register->ptes;
+	for (unsigned long i = 0; i < sync_top; i++) {
+		if (!same_entry(ptes[i], shadow[i])) {
+			mmu_map(i, ptes[i]);
+			harness_stats.remaps++;
+		}
+	}
+	harness_stats.sync_ns += now_ns() - start;
+}
+
+// times a call into the pager, then syncs the MMU with what it did to the page table
+class Pager_call{
+	unsigned long long start;
+public:
+	Pager_call() {
+		start = now_ns();
+	}
+	~Pager_call() {
+		harness_stats.pager_ns += now_ns() - start;
+		mmu_sync();
+	}
+};
+
+/**********
+processes
+	each has a coroutine; the scheduler (run_processes) runs the one at the front of ready,
+	calling vm_switch first when it is not the one that ran last
+	a process ends by returning from main or by a fault vm_fault refuses; the scheduler
+	then calls vm_destroy while it is still current
+**********/
+typedef struct {
+	pid_t pid;
+	ucontext_t context;
+	void *stack;
+	bool done;
+	void (*entry)(void *);	// harness_fork child, 0 runs main
+	void *arg;
+} process;
+
+deque<process *> ready;
+process *running;
+ucontext_t scheduler_context;
+pid_t next_pid = 1000;
+
+void process_main();
+
+process *
+new_process(void (*entry)(void *), void *arg)
+{
+	process *p = new process();
+	p->pid = next_pid++;
+	p->entry = entry;
+	p->arg = arg;
+	p->stack = mmap(0, STACK_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p->stack == MAP_FAILED) {
+		perror("stack");
+		abort();
+	}
+	getcontext(&p->context);
+	p->context.uc_stack.ss_sp = p->stack;
+	p->context.uc_stack.ss_size = STACK_SIZE;
+	p->context.uc_link = 0;
+	makecontext(&p->context, process_main, 0);
+	harness_stats.processes++;
+	return p;
+}
+
+void
+process_main()
+{
+	if (running->entry) {
+		running->entry(running->arg);
+		running->done = true;
+		swapcontext(&running->context, &scheduler_context);
+	}
+	int (*main_void)() = vm_app_main;
+	int (*main_args)(int, char **) = vm_app_main;
+	int (*main_const_args)(int, char const **) = vm_app_main;
+	const char *argv[] = {"app", 0};
+	int status = 0;
+	if (main_void) {
+		status = main_void();
+	} else if (main_args) {
+		status = main_args(1, (char **)argv);
+	} else if (main_const_args) {
+		status = main_const_args(1, argv);
+	}
+	if (status) {
+		fprintf(stderr, "harness: process %d exited with status %d\n", running->pid, status);
+	}
+	running->done = true;
+	swapcontext(&running->context, &scheduler_context);
+}
+
+void
+segv_handler(int, siginfo_t *si, void *ctx)
+{
+	unsigned long addr = (unsigned long)si->si_addr;
+	unsigned long base = (unsigned long)VM_ARENA_BASEADDR;
+	if (!running || addr < base || addr >= base + VM_ARENA_SIZE) {
+		// not an arena fault: crash as usual on the next try
+		signal(SIGSEGV, SIG_DFL);
+		return;
+	}
+	ucontext_t *uc = (ucontext_t *)ctx;
+	bool write_flag = (uc->uc_mcontext.gregs[REG_ERR] & 2) != 0;
+	harness_stats.faults++;
+	int result;
+	unsigned long long start = now_ns();
+	{
+		Pager_call call;
+		result = vm_fault((void *)addr, write_flag);
+	}
+	record_latency(now_ns() - start);
+	if (harness_stats.faults % HEAP_SAMPLE == 0) {
+		sample_heap();
+	}
+	if (result == 0) {
+		return;
+	}
+	fprintf(stderr, "harness: process %d killed, %s fault at %p\n", running->pid,
+		write_flag ? "write" : "read", (void *)addr);
+	running->done = true;
+	// the scheduler's saved signal mask unblocks SIGSEGV again
+	setcontext(&scheduler_context);
+}
+
+void
+run_processes()
+{
+	process *last = 0;
+	while (!ready.empty()) {
+		running = ready.front();
+		ready.pop_front();
+		if (running != last) {
+			table_live = true;
+			Pager_call call;
+			vm_switch(running->pid);
+			last = running;
+			sample_heap();
+		}
+		swapcontext(&scheduler_context, &running->context);
+		if (running->done) {
+			{
+				Pager_call call;
+				vm_destroy();
+				// the page table may be gone; the next vm_switch brings a live one
+				table_live = false;
+			}
+			last = 0;
+			munmap(running->stack, STACK_SIZE);
+			delete running;
+		} else {
+			ready.push_back(running);
+		}
+		running = 0;
+	}
+}
+
+/**********
+application side of the pager interface
+**********/
+void *
+vm_extend_n(unsigned int count)
+{
+	Pager_call call;
+	void *page = pager_vm_extend_n(count);
+	if (page) {
+		// the new pages are synced from now on
+		unsigned long top = ((unsigned long)page - (unsigned long)VM_ARENA_BASEADDR) / VM_PAGESIZE + count;
+		sync_top = max(sync_top, top);
+		sample_heap();
+	}
+	return page;
+}
+
+void *
+vm_extend()
+{
+	return vm_extend_n(1);
+}
+
+int
+vm_syslog(void *message, unsigned int len)
+{
+	Pager_call call;
+	return pager_vm_syslog(message, len);
+}
+
+int
+vm_release(void *addr, unsigned int npages)
+{
+	Pager_call call;
+	return pager_vm_release(addr, npages);
+}
+
+int
+vm_advise(void *addr, unsigned int npages, int advice)
+{
+	Pager_call call;
+	return pager_vm_advise(addr, npages, advice);
+}
+
+void
+vm_yield()
+{
+	swapcontext(&running->context, &scheduler_context);
+}
+
+int
+harness_fork(void (*entry)(void *), void *arg)
+{
+	process *child = new_process(entry, arg);
+	int result;
+	{
+		Pager_call call;
+		result = vm_fork(running->pid, child->pid);
+	}
+	if (result) {
+		// new_process counted it, but it never ran
+		harness_stats.processes--;
+		munmap(child->stack, STACK_SIZE);
+		delete child;
+		return -1;
+	}
+	ready.push_back(child);
+	return 0;
+}
+
+int
+harness_set_quota(unsigned int min_frames, unsigned int max_frames)
+{
+	Pager_call call;
+	return vm_set_quota(running->pid, min_frames, max_frames);
+}
+
+int
+harness_working_set()
+{
+	Pager_call call;
+	return vm_working_set(running->pid);
+}
+
+int
+harness_resident()
+{
+	Pager_call call;
+	return vm_resident(running->pid);
+}
+
+/**********
+disk
+**********/
+void
+disk_rdwr(unsigned int block, unsigned int ppage, bool write)
+{
+	assert(block < disk_blocks && ppage < memory_pages);
+	if (write) {
+		harness_stats.disk_writes++;
+	} else {
+		harness_stats.disk_reads++;
+	}
+	char *frame = (char *)pm_physmem + (size_t)ppage * VM_PAGESIZE;
+	off_t offset = (off_t)block * VM_PAGESIZE;
+	size_t done = 0;
+	while (done < VM_PAGESIZE) {
+		ssize_t n = write ? pwrite(disk_fd, frame + done, VM_PAGESIZE - done, offset + done)
+			: pread(disk_fd, frame + done, VM_PAGESIZE - done, offset + done);
+		if (n <= 0) {
+			perror(write ? "disk_write" : "disk_read");
+			abort();
+		}
+		done += n;
+	}
+}
+
+void
+disk_read(unsigned int block, unsigned int ppage)
+{
+	disk_rdwr(block, ppage, false);
+}
+
+void
+disk_write(unsigned int block, unsigned int ppage)
+{
+	disk_rdwr(block, ppage, true);
+}
+
+void
+usage()
+{
+	fprintf(stderr, "usage: app [-m memory_pages] [-d disk_blocks] [-n processes] [-f disk_file] [-v]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned int nprocesses = 1;
+	const char *disk_file = 0;
+	bool verbose = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "m:d:n:f:v")) != -1) {
+		switch (opt) {
+		case 'm':
+			memory_pages = atoi(optarg);
+			break;
+		case 'd':
+			disk_blocks = atoi(optarg);
+			break;
+		case 'n':
+			nprocesses = atoi(optarg);
+			break;
+		case 'f':
+			disk_file = optarg;
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (memory_pages < 2 || memory_pages > (1 << 20) || !nprocesses) {
+		usage();
+	}
+	assert(VM_PAGESIZE % getpagesize() == 0);
+
+	physmem_fd = memfd_create("pm_physmem", 0);
+	if (physmem_fd < 0 || ftruncate(physmem_fd, (off_t)memory_pages * VM_PAGESIZE)) {
+		perror("pm_physmem");
+		return 1;
+	}
+	pm_physmem = mmap(0, (size_t)memory_pages * VM_PAGESIZE, PROT_READ | PROT_WRITE, MAP_SHARED, physmem_fd, 0);
+	if (pm_physmem == MAP_FAILED) {
+		perror("pm_physmem");
+		return 1;
+	}
+	if (mmap(VM_ARENA_BASEADDR, VM_ARENA_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE | MAP_NORESERVE,
+		-1, 0) != VM_ARENA_BASEADDR) {
+		perror("arena");
+		return 1;
+	}
+	char tmp[] = "/tmp/vm_disk.XXXXXX";
+	disk_fd = disk_file ? open(disk_file, O_RDWR | O_CREAT, 0644) : mkstemp(tmp);
+	if (disk_fd < 0 || ftruncate(disk_fd, (off_t)disk_blocks * VM_PAGESIZE)) {
+		perror("disk");
+		return 1;
+	}
+	if (!disk_file) {
+		unlink(tmp);
+	}
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_sigaction = segv_handler;
+	sa.sa_flags = SA_SIGINFO;
+	sigaction(SIGSEGV, &sa, 0);
+
+	unsigned long long start = now_ns();
+	vm_init(memory_pages, disk_blocks);
+	for (unsigned int i = 0; i < nprocesses; i++) {
+		process *p = new_process(0, 0);
+		vm_create(p->pid);
+		ready.push_back(p);
+	}
+	run_processes();
+	if (verbose) {
+		double total = (now_ns() - start) / 1e9;
+		struct rusage ru;
+		getrusage(RUSAGE_SELF, &ru);
+		fprintf(stderr, "harness: processes=%lu faults=%lu faults_per_sec=%.0f disk_reads=%lu disk_writes=%lu "
+			"fault_p50_us=%.2f fault_p99_us=%.2f pager_heap_kb=%zu max_rss_kb=%ld remaps=%lu "
+			"pager_s=%.3f mmu_sync_s=%.3f total_s=%.3f\n",
+			harness_stats.processes, harness_stats.faults, harness_stats.faults / total,
+			harness_stats.disk_reads, harness_stats.disk_writes, latency_quantile(0.5) / 1e3,
+			latency_quantile(0.99) / 1e3, harness_stats.peak_heap / 1024, ru.ru_maxrss,
+			harness_stats.remaps, harness_stats.pager_ns / 1e9, harness_stats.sync_ns / 1e9, total);
+	}
+	return 0;
+}
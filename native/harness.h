@@ -0,0 +1,56 @@
+/*
+ * harness.h
+ *
+ * Extensions the native harness offers to applications built against it,
+ * on top of vm_app.h
+ */
+
+#ifndef _HARNESS_H_
+#define _HARNESS_H_
+
+#include "vm_advice.h"
+
+/*
+ * vm_extend_n() -- like vm_extend(), but ask for the lowest "count" invalid
+ * virtual pages to be declared valid in one request.  Returns the
+ * lowest-numbered byte of the first new page, or NULL (and no page is
+ * declared valid) if count is 0 or the disk is out of swap space for all of
+ * them.  libvm_app.a does not offer it.
+ */
+extern void *vm_extend_n(unsigned int count);
+
+/*
+ * vm_release() -- give back npages pages starting at the page-aligned
+ * address addr.  The pages become invalid; if they were the highest valid
+ * pages, the next vm_extend() hands them out again.  Returns 0 on success,
+ * -1 on failure (e.g., some page in the range is not valid).
+ */
+extern int vm_release(void *addr, unsigned int npages);
+
+/*
+ * vm_advise() -- hint how npages valid pages starting at the page-aligned
+ * address addr will be used.  VM_ADVICE_SEQUENTIAL and VM_ADVICE_RANDOM
+ * steer read-ahead, VM_ADVICE_WILLNEED reads the pages in now, and
+ * VM_ADVICE_DONTNEED discards their contents (they read back as zeros).
+ * Returns 0 on success, -1 on failure.  libvm_app.a offers neither call.
+ */
+extern int vm_advise(void *addr, unsigned int npages, int advice);
+
+/*
+ * harness_fork() -- fork the current process with vm_fork.  The child gets
+ * a copy-on-write copy of the arena and runs entry(arg) on a stack of its
+ * own after the processes already waiting to run; it exits when entry
+ * returns.  Returns 0 on success, -1 if the pager refused the fork.
+ */
+extern int harness_fork(void (*entry)(void *), void *arg);
+
+/*
+ * harness_set_quota(), harness_working_set(), harness_resident() -- call
+ * vm_set_quota, vm_working_set and vm_resident (vm_pager.h) for the current
+ * process and return what they do: 0 or -1, and a number of pages or -1.
+ */
+extern int harness_set_quota(unsigned int min_frames, unsigned int max_frames);
+extern int harness_working_set();
+extern int harness_resident();
+
+#endif /* _HARNESS_H_ */
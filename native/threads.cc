@@ -0,0 +1,274 @@
+#include "vm_pager.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+
+using namespace std;
+
+/**********
+threads: several pthreads serving faults at once, a driver for the "concurrency" part of pager.cc
+	each thread runs -r processes one after another: vm_create, vm_switch, vm_extend_n of -p
+	pages, -o accesses to random pages (30% writes), vm_destroy
+	a write stores a new stamp in the word at STAMP_OFFSET of its page, and every access checks
+	that word against the stamp the thread wrote last, so lost or crossed data fails the run
+	every -f accesses a thread vm_forks the process another thread runs (which may be exiting
+	meanwhile), makes CHILD_OPS accesses to the copy-on-write child, half of them writes the
+	parent must never see, destroys it and switches back
+	MMU: simulated per thread. An access walks the page table vm_mmu_lock returns, the one of
+		this thread's process, and touches the frame in pm_physmem before vm_mmu_unlock; if
+		the entry does not allow it, it calls vm_fault and tries again
+	disk: in memory, every disk_read and disk_write sleeps -u microseconds first (default 50),
+		so the page-ins and write-backs of different threads overlap; max_io_in_flight shows
+		by how much
+
+pager.cc is built with its application entry points renamed (see the Makefile); only
+pager_vm_extend_n is used.
+
+usage: threads [-m memory_pages] [-d disk_blocks] [-t threads] [-p pages] [-o ops] [-r rounds]
+	[-u disk_us] [-f fork_every] [-v]
+	-v prints one line of key=value measurements at exit
+**********/
+
+// pager.cc's
+extern void *pager_vm_extend_n(unsigned int count);
+
+#define STAMP_OFFSET (VM_PAGESIZE / 2)
+#define CHILD_OPS 32
+
+void *pm_physmem;
+page_table_t *page_table_base_register;
+
+unsigned int memory_pages = 64;
+unsigned int disk_blocks = 1024;
+unsigned int nthreads = 4;
+unsigned int pages = 96;
+unsigned long ops = 20000;
+unsigned int rounds = 2;
+unsigned int disk_us = 50;
+unsigned int fork_every = 500;
+vector<char> disk;
+
+atomic<pid_t> next_pid(1);
+atomic<pid_t> *live_pids;	// the process each thread runs, 0 between two
+atomic<unsigned long> faults, disk_reads, disk_writes, processes;
+atomic<unsigned int> io_running, max_io_in_flight;
+
+typedef struct {
+	unsigned int index;
+	unsigned long long rng;
+	unsigned int next_stamp;
+	vector<unsigned long> stamps;	// last stamp written to each page, 0 if never
+} thread_state;
+
+unsigned long long
+now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+unsigned int
+next_random(thread_state *t)
+{
+	t->rng ^= t->rng << 13;
+	t->rng ^= t->rng >> 7;
+	t->rng ^= t->rng << 17;
+	return t->rng >> 16;
+}
+
+// the MMU: returns the word the access saw, after storing stamp if it writes
+unsigned long
+mmu_access(unsigned int page, bool write, unsigned long stamp)
+{
+	for (;;) {
+		page_table_entry_t *pte = &vm_mmu_lock()->ptes[page];
+		if (write ? pte->write_enable : pte->read_enable) {
+			unsigned long *word = (unsigned long *)((char *)pm_physmem + (size_t)pte->ppage * VM_PAGESIZE + STAMP_OFFSET);
+			unsigned long seen = *word;
+			if (write) {
+				*word = stamp;
+			}
+			vm_mmu_unlock();
+			return seen;
+		}
+		vm_mmu_unlock();
+		faults++;
+		if (vm_fault((char *)VM_ARENA_BASEADDR + (size_t)page * VM_PAGESIZE, write)) {
+			fprintf(stderr, "threads: vm_fault of page %u failed\n", page);
+			abort();
+		}
+	}
+}
+
+// fork another thread's process, scribble on the child and destroy it
+void
+fork_other(thread_state *t, pid_t self)
+{
+	pid_t parent = live_pids[next_random(t) % nthreads];
+	pid_t child = next_pid++;
+	if (!parent || vm_fork(parent, child)) {
+		return;
+	}
+	processes++;
+	vm_switch(child);
+	for (unsigned int i = 0; i < CHILD_OPS; i++) {
+		mmu_access(next_random(t) % pages, i % 2, 0);
+	}
+	vm_destroy();
+	vm_switch(self);
+}
+
+void *
+thread_main(void *arg)
+{
+	thread_state *t = (thread_state *)arg;
+	for (unsigned int round = 0; round < rounds; round++) {
+		pid_t pid = next_pid++;
+		processes++;
+		vm_create(pid);
+		vm_switch(pid);
+		if (pager_vm_extend_n(pages) != VM_ARENA_BASEADDR) {
+			fprintf(stderr, "threads: vm_extend_n(%u) failed\n", pages);
+			abort();
+		}
+		t->stamps.assign(pages, 0);
+		live_pids[t->index] = pid;
+		for (unsigned long i = 0; i < ops; i++) {
+			unsigned int page = next_random(t) % pages;
+			bool write = next_random(t) % 100 < 30;
+			unsigned long stamp = write ? (unsigned long)pid << 32 | ++t->next_stamp : 0;
+			unsigned long seen = mmu_access(page, write, stamp);
+			if (seen != t->stamps[page]) {
+				fprintf(stderr, "threads: process %d page %u holds %#lx, expected %#lx\n",
+					pid, page, seen, t->stamps[page]);
+				abort();
+			}
+			if (write) {
+				t->stamps[page] = stamp;
+			}
+			if (fork_every && i % fork_every == fork_every - 1) {
+				fork_other(t, pid);
+			}
+		}
+		live_pids[t->index] = 0;
+		vm_destroy();
+	}
+	return 0;
+}
+
+/**********
+disk
+**********/
+void
+disk_wait()
+{
+	unsigned int running = ++io_running;
+	unsigned int max = max_io_in_flight;
+	while (running > max && !max_io_in_flight.compare_exchange_weak(max, running)) {
+	}
+	usleep(disk_us);
+}
+
+void
+disk_read(unsigned int block, unsigned int ppage)
+{
+	assert(block < disk_blocks && ppage < memory_pages);
+	disk_reads++;
+	disk_wait();
+	memcpy((char *)pm_physmem + (size_t)ppage * VM_PAGESIZE, &disk[(size_t)block * VM_PAGESIZE], VM_PAGESIZE);
+	io_running--;
+}
+
+void
+disk_write(unsigned int block, unsigned int ppage)
+{
+	assert(block < disk_blocks && ppage < memory_pages);
+	disk_writes++;
+	disk_wait();
+	memcpy(&disk[(size_t)block * VM_PAGESIZE], (char *)pm_physmem + (size_t)ppage * VM_PAGESIZE, VM_PAGESIZE);
+	io_running--;
+}
+
+void
+usage()
+{
+	fprintf(stderr, "usage: threads [-m memory_pages] [-d disk_blocks] [-t threads] [-p pages] [-o ops] [-r rounds] "
+		"[-u disk_us] [-f fork_every] [-v]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	bool verbose = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "m:d:t:p:o:r:u:f:v")) != -1) {
+		switch (opt) {
+		case 'm':
+			memory_pages = atoi(optarg);
+			break;
+		case 'd':
+			disk_blocks = atoi(optarg);
+			break;
+		case 't':
+			nthreads = atoi(optarg);
+			break;
+		case 'p':
+			pages = atoi(optarg);
+			break;
+		case 'o':
+			ops = strtoul(optarg, 0, 0);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'u':
+			disk_us = atoi(optarg);
+			break;
+		case 'f':
+			fork_every = atoi(optarg);
+			break;
+		case 'v':
+			verbose = true;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (memory_pages < 2 || memory_pages > (1 << 20) || !nthreads || !pages
+		|| pages > VM_ARENA_SIZE / VM_PAGESIZE) {
+		usage();
+	}
+	pm_physmem = calloc(memory_pages, VM_PAGESIZE);
+	disk.assign((size_t)disk_blocks * VM_PAGESIZE, 0);
+	live_pids = new atomic<pid_t>[nthreads]();
+
+	unsigned long long start = now_ns();
+	vm_init(memory_pages, disk_blocks);
+	vector<pthread_t> threads(nthreads);
+	vector<thread_state> states(nthreads);
+	for (unsigned int i = 0; i < nthreads; i++) {
+		states[i].index = i;
+		states[i].rng = 0x9e3779b97f4a7c15ULL * (i + 1);
+		states[i].next_stamp = 0;
+		pthread_create(&threads[i], 0, thread_main, &states[i]);
+	}
+	for (unsigned int i = 0; i < nthreads; i++) {
+		pthread_join(threads[i], 0);
+	}
+	if (verbose) {
+		double total = (now_ns() - start) / 1e9;
+		fprintf(stderr, "threads: threads=%u processes=%lu faults=%lu faults_per_sec=%.0f disk_reads=%lu "
+			"disk_writes=%lu max_io_in_flight=%u total_s=%.3f\n",
+			nthreads, processes.load(), faults.load(), faults / total, disk_reads.load(),
+			disk_writes.load(), max_io_in_flight.load(), total);
+	}
+	return 0;
+}
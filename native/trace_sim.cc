@@ -0,0 +1,632 @@
+#include "vm_trace.h"
+#include "vm_pager.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <vector>
+#include <deque>
+#include <set>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+
+using namespace std;
+
+/**********
+trace_sim: replay a VM_TRACE trace offline at many memory sizes
+	usage: trace_sim [-s sizes] [-p policies] trace
+		sizes: comma separated frame counts (default powers of two up to the pages in the trace)
+		policies: comma separated, of lru, opt, clock, fifo and the pager's own pager-clock,
+			pager-clockpro, pager-arc, pager-lruk and pager-2q (default all of them)
+	prints the miss ratio of every policy at every size, in percent of the references
+
+	references: every fault of the trace, one page of one process each.  A page leaves memory
+	when it is released, discarded or its process exits, and comes back as a new page; a
+	forked child's pages are new pages too (first touch misses, like a private copy)
+	each page incarnation gets a dense id, and the trace becomes a list of events: a
+	reference to an id, or the drop of one
+
+	lru: Mattson's stack algorithm, one pass for every size at once.  A Fenwick tree over
+		reference times holds a 1 at the last reference of every live page, so the stack
+		distance of a reference is the count of 1s since the page's previous one; misses at
+		C frames = first references + references at a distance above C
+	opt: Belady's MIN, evicts the page referenced furthest in the future; next-use times
+		come from one backward pass, then one simulation per size
+	clock: second chance, a page is loaded referenced like the pager's frames; fifo
+	pager-*: the trace replayed through pager.cc itself with VM_PAGER_POLICY set, see below
+	policies are listed in policies[] and take the same events, a new one only needs a
+	function running it at one size
+**********/
+
+// id of a reference, or -(id + 1) for a drop
+vector<int> events;
+unsigned int page_ids;
+unsigned long references, writes, processes;
+
+typedef unsigned long (*policy_run)(unsigned int frames);
+
+// the trace as recorded, for the pager policies
+vector<vm_trace_record_t> records;
+vector<char> first_reference;	// per reference, whether its page incarnation starts there
+unsigned int max_valid;	// most pages valid at once over all processes
+
+/**********
+trace loading
+	live: id of every page of every process now in memory, by (pid << 32 | vpn)
+	pages_of: vpns of every process that have an id, to drop them on release or exit
+	valid_of: valid pages of every process, for max_valid
+**********/
+unordered_map<unsigned long long, int> live;
+map<unsigned int, set<unsigned int> > pages_of;
+map<unsigned int, unsigned int> valid_of;
+unsigned int valid_total;
+
+void
+count_valid(unsigned int pid, unsigned int valid)
+{
+	valid_total += valid - valid_of[pid];
+	valid_of[pid] = valid;
+	max_valid = max(max_valid, valid_total);
+}
+
+unsigned long long
+page_key(unsigned int pid, unsigned int vpn)
+{
+	return (unsigned long long)pid << 32 | vpn;
+}
+
+void
+drop_pages(unsigned int pid, unsigned int first, unsigned long count)
+{
+	set<unsigned int> &pages = pages_of[pid];
+	set<unsigned int>::iterator it = pages.lower_bound(first);
+	while (it != pages.end() && *it - first < count) {
+		unordered_map<unsigned long long, int>::iterator page = live.find(page_key(pid, *it));
+		events.push_back(-(page->second + 1));
+		live.erase(page);
+		pages.erase(it++);
+	}
+}
+
+bool
+load_trace(const char *file)
+{
+	FILE *f = fopen(file, "rb");
+	char magic[8];
+	if (!f || fread(magic, 1, 8, f) != 8 || memcmp(magic, VM_TRACE_MAGIC, 8)) {
+		fprintf(stderr, "trace_sim: %s is not a trace\n", file);
+		return false;
+	}
+	vm_trace_record_t buffer[4096];
+	unsigned int current = 0, parent = 0;
+	size_t n;
+	while ((n = fread(buffer, sizeof(vm_trace_record_t), 4096, f)) > 0) {
+		for (size_t i = 0; i < n; i++) {
+			vm_trace_record_t r = buffer[i];
+			records.push_back(r);
+			switch (VM_TRACE_OP(r)) {
+			case VM_TRACE_READ:
+			case VM_TRACE_WRITE: {
+				unsigned long long key = page_key(current, r.value);
+				unordered_map<unsigned long long, int>::iterator page = live.find(key);
+				int id;
+				first_reference.push_back(page == live.end());
+				if (page == live.end()) {
+					id = page_ids++;
+					live[key] = id;
+					pages_of[current].insert(r.value);
+				} else {
+					id = page->second;
+				}
+				events.push_back(id);
+				references++;
+				writes += VM_TRACE_OP(r) == VM_TRACE_WRITE;
+				break;
+			}
+			case VM_TRACE_CREATE:
+				processes++;
+				break;
+			case VM_TRACE_PARENT:
+				parent = r.value;
+				break;
+			case VM_TRACE_FORK:
+				processes++;
+				count_valid(r.value, valid_of[parent]);
+				break;
+			case VM_TRACE_SWITCH:
+				current = r.value;
+				break;
+			case VM_TRACE_EXTEND:
+				count_valid(current, valid_of[current] + VM_TRACE_COUNT(r));
+				break;
+			case VM_TRACE_RELEASE:
+				count_valid(current, valid_of[current] - VM_TRACE_COUNT(r));
+				drop_pages(current, r.value, VM_TRACE_COUNT(r));
+				break;
+			case VM_TRACE_DISCARD:
+				drop_pages(current, r.value, VM_TRACE_COUNT(r));
+				break;
+			case VM_TRACE_DESTROY:
+				count_valid(current, 0);
+				valid_of.erase(current);
+				drop_pages(current, 0, (unsigned long)-1);
+				pages_of.erase(current);
+				break;
+			}
+		}
+	}
+	fclose(f);
+	return true;
+}
+
+/**********
+lru: misses at every size from one histogram of stack distances
+**********/
+vector<unsigned long> distance_count;	// distance_count[d]: references at stack distance d
+unsigned long first_references;
+
+// Fenwick tree over reference times
+vector<int> fenwick;
+
+void
+fenwick_add(unsigned int i, int delta)
+{
+	for (i++; i < fenwick.size(); i += i & -i) {
+		fenwick[i] += delta;
+	}
+}
+
+// sum of [0, i)
+int
+fenwick_sum(unsigned int i)
+{
+	int sum = 0;
+	for (; i > 0; i -= i & -i) {
+		sum += fenwick[i];
+	}
+	return sum;
+}
+
+void
+lru_distances()
+{
+	vector<long> last(page_ids, -1);
+	fenwick.assign(references + 1, 0);
+	distance_count.assign(page_ids + 2, 0);
+	unsigned long t = 0;
+	for (unsigned long e = 0; e < events.size(); e++) {
+		if (events[e] < 0) {
+			int id = -events[e] - 1;
+			if (last[id] >= 0) {
+				fenwick_add(last[id], -1);
+			}
+			continue;
+		}
+		int id = events[e];
+		if (last[id] < 0) {
+			first_references++;
+		} else {
+			// pages referenced since, this one included
+			distance_count[fenwick_sum(t) - fenwick_sum(last[id] + 1) + 1]++;
+			fenwick_add(last[id], -1);
+		}
+		fenwick_add(t, 1);
+		last[id] = t++;
+	}
+}
+
+unsigned long
+run_lru(unsigned int frames)
+{
+	unsigned long misses = first_references;
+	for (unsigned long d = frames + 1; d < distance_count.size(); d++) {
+		misses += distance_count[d];
+	}
+	return misses;
+}
+
+/**********
+opt
+**********/
+vector<unsigned long> next_use;	// per event, the event index of the page's next reference
+
+void
+opt_next_uses()
+{
+	vector<unsigned long> next(page_ids, (unsigned long)-1);
+	next_use.resize(events.size());
+	for (unsigned long e = events.size(); e-- > 0; ) {
+		if (events[e] >= 0) {
+			next_use[e] = next[events[e]];
+			next[events[e]] = e;
+		}
+	}
+}
+
+unsigned long
+run_opt(unsigned int frames)
+{
+	set<pair<unsigned long, int> > resident;	// by next use, the furthest last
+	vector<unsigned long> resident_next(page_ids);
+	vector<char> in(page_ids, 0);
+	unsigned long misses = 0;
+	for (unsigned long e = 0; e < events.size(); e++) {
+		if (events[e] < 0) {
+			int id = -events[e] - 1;
+			if (in[id]) {
+				resident.erase(make_pair(resident_next[id], id));
+				in[id] = 0;
+			}
+			continue;
+		}
+		int id = events[e];
+		if (in[id]) {
+			resident.erase(make_pair(resident_next[id], id));
+		} else {
+			misses++;
+			if (resident.size() == frames) {
+				set<pair<unsigned long, int> >::iterator victim = --resident.end();
+				in[victim->second] = 0;
+				resident.erase(victim);
+			}
+			in[id] = 1;
+		}
+		resident_next[id] = next_use[e];
+		resident.insert(make_pair(next_use[e], id));
+	}
+	return misses;
+}
+
+/**********
+clock and fifo
+**********/
+unsigned long
+run_clock(unsigned int frames)
+{
+	vector<int> frame_page(frames, -1);
+	vector<char> ref(frames, 0);
+	vector<int> frame_of(page_ids, -1);
+	vector<unsigned int> free_frames;
+	for (unsigned int f = frames; f-- > 0; ) {
+		free_frames.push_back(f);
+	}
+	unsigned int hand = 0;
+	unsigned long misses = 0;
+	for (unsigned long e = 0; e < events.size(); e++) {
+		if (events[e] < 0) {
+			int id = -events[e] - 1;
+			if (frame_of[id] >= 0) {
+				frame_page[frame_of[id]] = -1;
+				free_frames.push_back(frame_of[id]);
+				frame_of[id] = -1;
+			}
+			continue;
+		}
+		int id = events[e];
+		if (frame_of[id] >= 0) {
+			ref[frame_of[id]] = 1;
+			continue;
+		}
+		misses++;
+		unsigned int frame;
+		if (!free_frames.empty()) {
+			frame = free_frames.back();
+			free_frames.pop_back();
+		} else {
+			while (ref[hand]) {
+				ref[hand] = 0;
+				hand = (hand + 1) % frames;
+			}
+			frame = hand;
+			hand = (hand + 1) % frames;
+			frame_of[frame_page[frame]] = -1;
+		}
+		frame_page[frame] = id;
+		frame_of[id] = frame;
+		ref[frame] = 1;
+	}
+	return misses;
+}
+
+unsigned long
+run_fifo(unsigned int frames)
+{
+	deque<int> queue;	// dropped pages stay until they reach the front
+	vector<char> in(page_ids, 0);
+	unsigned int resident = 0;
+	unsigned long misses = 0;
+	for (unsigned long e = 0; e < events.size(); e++) {
+		if (events[e] < 0) {
+			int id = -events[e] - 1;
+			if (in[id]) {
+				in[id] = 0;
+				resident--;
+			}
+			continue;
+		}
+		int id = events[e];
+		if (in[id]) {
+			continue;
+		}
+		misses++;
+		if (resident == frames) {
+			while (!in[queue.front()]) {
+				queue.pop_front();
+			}
+			in[queue.front()] = 0;
+			queue.pop_front();
+			resident--;
+		}
+		queue.push_back(id);
+		in[id] = 1;
+		resident++;
+	}
+	return misses;
+}
+
+/**********
+pager policies: the trace replayed through pager.cc, linked in with its entry points renamed
+like the harness's, in a forked child per policy and size
+	the child runs vm_init with frames + 1 memory pages (one becomes zero_frame) and
+	VM_PAGER_POLICY set, with pager_env_off unset and the cleaner off, so only the policy
+	decides what stays resident and every write happens at eviction; disk blocks are
+	max_valid + 1, so no extend or fork fails for want of swap
+	every record is replayed as the pager saw it.  A reference the replayed page table allows
+	is a hit the pager never sees, any other calls vm_fault.  A miss is a first reference,
+	as for the other policies, a fault that read the disk or one that mapped zero_frame
+	(frame index frames), which the other policies would have given a frame
+	the records of a process the pager refused to fork are skipped
+	the child writes its misses into a pipe
+**********/
+const char *pager_env_off[] = { "VM_READAHEAD", "VM_KSM", "VM_ZSWAP", "VM_LOAD_CONTROL", "VM_OVERCOMMIT",
+	"VM_TRACE", "VM_STATS", "VM_SYSLOG_RING", 0 };
+
+// pager.cc is built with -Dvm_extend_n=pager_vm_extend_n etc.
+extern void *pager_vm_extend_n(unsigned int count);
+extern int pager_vm_release(void *addr, unsigned int npages);
+extern int pager_vm_advise(void *addr, unsigned int npages, int advice);
+
+void *pm_physmem;
+page_table_t *page_table_base_register;
+unsigned long disk_reads;
+
+void
+disk_read(unsigned int, unsigned int)
+{
+	disk_reads++;
+}
+
+void
+disk_write(unsigned int, unsigned int)
+{
+}
+
+char *
+page_addr(unsigned int vpn)
+{
+	return (char *)VM_ARENA_BASEADDR + (size_t)vpn * VM_PAGESIZE;
+}
+
+unsigned long
+replay(unsigned int frames)
+{
+	pm_physmem = calloc(frames + 1, VM_PAGESIZE);
+	vm_init(frames + 1, max_valid + 1);
+	set<unsigned int> alive;
+	unsigned int current = 0, parent = 0;
+	unsigned long reference = 0, misses = 0;
+	for (unsigned long i = 0; i < records.size(); i++) {
+		vm_trace_record_t r = records[i];
+		unsigned int count = VM_TRACE_COUNT(r);
+		bool write = VM_TRACE_OP(r) == VM_TRACE_WRITE;
+		bool running = alive.count(current);
+		switch (VM_TRACE_OP(r)) {
+		case VM_TRACE_READ:
+		case VM_TRACE_WRITE: {
+			bool first = first_reference[reference++];
+			page_table_entry_t *pte = running ? &page_table_base_register->ptes[r.value] : 0;
+			if (!pte || (write ? pte->write_enable : pte->read_enable)) {
+				misses += first;
+				break;
+			}
+			unsigned long reads = disk_reads;
+			vm_fault(page_addr(r.value), write);
+			misses += first || disk_reads != reads || (pte->read_enable && pte->ppage == frames);
+			break;
+		}
+		case VM_TRACE_CREATE:
+			vm_create(r.value);
+			alive.insert(r.value);
+			break;
+		case VM_TRACE_PARENT:
+			parent = r.value;
+			break;
+		case VM_TRACE_FORK:
+			if (alive.count(parent) && !vm_fork(parent, r.value)) {
+				alive.insert(r.value);
+			}
+			break;
+		case VM_TRACE_SWITCH:
+			current = r.value;
+			if (alive.count(current)) {
+				vm_switch(current);
+			}
+			break;
+		case VM_TRACE_EXTEND:
+			if (running) {
+				pager_vm_extend_n(count);
+			}
+			break;
+		case VM_TRACE_RELEASE:
+			if (running) {
+				pager_vm_release(page_addr(r.value), count);
+			}
+			break;
+		case VM_TRACE_DISCARD:
+			if (running) {
+				pager_vm_advise(page_addr(r.value), count, VM_ADVICE_DONTNEED);
+			}
+			break;
+		case VM_TRACE_DESTROY:
+			if (running) {
+				vm_destroy();
+				alive.erase(current);
+			}
+			break;
+		}
+	}
+	return misses;
+}
+
+unsigned long
+run_pager(const char *policy, unsigned int frames)
+{
+	int fds[2];
+	if (pipe(fds)) {
+		perror("pipe");
+		exit(1);
+	}
+	fflush(stdout);
+	pid_t child = fork();
+	if (child == 0) {
+		close(fds[0]);
+		setenv("VM_PAGER_POLICY", policy, 1);
+		setenv("VM_CLEANER_RESERVE", "0", 1);
+		for (const char **name = pager_env_off; *name; name++) {
+			unsetenv(*name);
+		}
+		unsigned long misses = replay(frames);
+		_exit(write(fds[1], &misses, sizeof(misses)) != sizeof(misses));
+	}
+	close(fds[1]);
+	unsigned long misses;
+	bool done = child > 0 && read(fds[0], &misses, sizeof(misses)) == sizeof(misses);
+	close(fds[0]);
+	if (child > 0) {
+		waitpid(child, 0, 0);
+	}
+	if (!done) {
+		fprintf(stderr, "trace_sim: replaying through the pager's %s at %u frames failed\n", policy, frames);
+		exit(1);
+	}
+	return misses;
+}
+
+unsigned long
+run_pager_clock(unsigned int frames)
+{
+	return run_pager("clock", frames);
+}
+
+unsigned long
+run_pager_clockpro(unsigned int frames)
+{
+	return run_pager("clockpro", frames);
+}
+
+unsigned long
+run_pager_arc(unsigned int frames)
+{
+	return run_pager("arc", frames);
+}
+
+unsigned long
+run_pager_lruk(unsigned int frames)
+{
+	return run_pager("lruk", frames);
+}
+
+unsigned long
+run_pager_2q(unsigned int frames)
+{
+	return run_pager("2q", frames);
+}
+
+struct {
+	const char *name;
+	policy_run run;
+} policies[] = {
+	{"lru", run_lru},
+	{"opt", run_opt},
+	{"clock", run_clock},
+	{"fifo", run_fifo},
+	{"pager-clock", run_pager_clock},
+	{"pager-clockpro", run_pager_clockpro},
+	{"pager-arc", run_pager_arc},
+	{"pager-lruk", run_pager_lruk},
+	{"pager-2q", run_pager_2q},
+};
+#define POLICIES (sizeof(policies) / sizeof(*policies))
+
+void
+usage()
+{
+	fprintf(stderr, "usage: trace_sim [-s size,...] [-p lru,opt,clock,fifo,pager-clock,pager-clockpro,"
+		"pager-arc,pager-lruk,pager-2q] trace\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	vector<unsigned int> sizes;
+	vector<unsigned int> chosen;
+	int opt;
+	while ((opt = getopt(argc, argv, "s:p:")) != -1) {
+		if (opt == 's') {
+			for (char *s = strtok(optarg, ","); s; s = strtok(0, ",")) {
+				if (atoi(s) > 0) {
+					sizes.push_back(atoi(s));
+				}
+			}
+		} else if (opt == 'p') {
+			for (char *s = strtok(optarg, ","); s; s = strtok(0, ",")) {
+				unsigned int p = 0;
+				while (p < POLICIES && strcmp(policies[p].name, s)) {
+					p++;
+				}
+				if (p == POLICIES) {
+					usage();
+				}
+				chosen.push_back(p);
+			}
+		} else {
+			usage();
+		}
+	}
+	if (optind != argc - 1 || !load_trace(argv[optind])) {
+		usage();
+	}
+	if (chosen.empty()) {
+		for (unsigned int p = 0; p < POLICIES; p++) {
+			chosen.push_back(p);
+		}
+	}
+	if (sizes.empty()) {
+		for (unsigned int size = 1; size < 2 * page_ids; size *= 2) {
+			sizes.push_back(size);
+		}
+	}
+	lru_distances();
+	opt_next_uses();
+
+	printf("# %lu references (%lu writes), %u pages, %lu processes, %lu first references\n",
+		references, writes, page_ids, processes, first_references);
+	printf("%8s", "frames");
+	for (unsigned int p = 0; p < chosen.size(); p++) {
+		printf(" %8s", policies[chosen[p]].name);	// wider names widen their column
+	}
+	printf("\n");
+	for (unsigned int s = 0; s < sizes.size(); s++) {
+		printf("%8u", sizes[s]);
+		for (unsigned int p = 0; p < chosen.size(); p++) {
+			unsigned long misses = policies[chosen[p]].run(sizes[s]);
+			printf(" %*.2f", max(8, (int)strlen(policies[chosen[p]].name)),
+				references ? 100.0 * misses / references : 0.0);
+		}
+		printf("\n");
+	}
+	return 0;
+}
@@ -1,11 +1,23 @@
 #include "vm_pager.h"
-#include <map>
+#include "vm_trace.h"
+#include <unordered_map>
 #include <stdlib.h>
 #include <stdio.h>
 #include <vector>
 #include <string.h>
 #include <list>
-#include <iostream>
+#include <set>
+#include <algorithm>
+#include <atomic>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
 
 using namespace std;
 
@@ -13,458 +25,4134 @@ using namespace std;
 data structure needed:
 	free_phy_mem_list: a linked list (vector) for free physical mem page
 
-	free_disk_block_list: a linked list (vector) for free disk block
+	swap_space: free disk blocks (Swap_allocator), handed out so a process's pages stay in vpn order on disk
+
+	vm_info: process table, pid -> slot hash plus a slot-indexed vector of proc_vm_info
+		clock nodes remember the slot so the sweep never hashes
 
 	proc_vm_info: store vm info of a process
-		page_table: page_table_t variable
+		page_table: page_table_t variable (dense mode)
+		last_fault_page, fault_stride, fault_run: page-in history for read-ahead
+		swap_runs: run of disk blocks claimed for each swap_space.run_size pages of the arena, -1 if none
+		resident_frames, ws_refs, working_set, min_frames, max_frames: see "working sets and quotas"
+		suspended, swapped_pages: see "load control"
+		lock, mmu_lock: see "concurrency"
+		pt_chunks: PTE_CHUNK-entry pieces of the page table covering [0, top) (sparse mode)
+			while the process runs its entries live in live_table instead, the live page table
+			of the thread that switched to it last, which is what page_table_base_register
+			points at; vm_switch moves them in and out
 		extra_info: a vector storing extra info of each valid virtual page
 			val: a bit indicate whether this virtual page is valid
 			res: whether the page resident in physical memory or disk
-			ref: has been referenced
-			dirt: has been written
-			new: a newly allocated page but not filled with 0
 			zero: a totally zero page (which need not to be paged out)
+				it holds no frame and no block; reads map zero_frame read-only
+			temped: resident and disk_num still holds an unmodified copy (in temp_disk_block_map)
+			advice: VM_ADVICE_NORMAL, _SEQUENTIAL or _RANDOM from vm_advise, steers read-ahead
 			disk_num: page-out
 
-	clock_queue: a queue (double_linked list) for clock algorithm
-		2 fields: pid, virtual_page_num
-		when a virtual page comes resident append it to rear
+	frame_table: one frame_info per physical page, plus FRAME_RING_HEADS dummy heads from index memory_pages
+		slot, virtual_page_num: owner of the frame
+		ref: has been referenced
+		dirt: has been written
+		pinned: must not be evicted right now (a copy-on-write source, a page syslog is
+			copying, a page being read in); a count, the pages of one message may share a frame
+		prefetched: paged in by read-ahead and not touched yet
+		in_use: owned by a page, not on free_phy_mem_page_list
+		shared: mapped read-only by several pages listed in frame_sharers (see "page merging"),
+			slot and virtual_page_num then name one of them
+		next, former: frame numbers linking the clock ring
+
+	replacement_policy: picks the frame to evict (see "replacement policies" below)
+		Clock_policy keeps the clock ring threaded through frame_table
+		when a virtual page comes resident append its frame to rear
 
 	temp_disk_block_map: when a block paged in, it should not set free instantly but act as a temp for efficiency when the same page is non-modified and paged out again.
-		key: pid, virtual_page_num
+		key: (pid, virtual_page_num) packed into 64 bits, hashed
 		value: block_num
+		the page's temped bit and disk_num say the same, so only stealing a temp block needs the map
 
+	zero_frame: one physical page kept filled with 0 and shared read-only by every zero page
+		that is read before it is written, -1 when memory_pages < 2
 	clock_pointer: point to eviction candidate
-	current_pid
+	current_pid, current_slot, current_info: the process this thread vm_switch'ed to
 
 **********/
 
 vector<unsigned long> free_phy_mem_page_list;
-vector<unsigned long> free_disk_block_list;
+int zero_frame = -1;
+// frames pages can own, memory_pages less the zero frame
+unsigned int private_pages;
+
+// disk_num of a page that holds no disk block
+#define NO_DISK_BLOCK ((unsigned long)-1)
+
 typedef struct {
 	unsigned int val : 1;
 	unsigned int res : 1;
-	unsigned int ref : 1;
-	unsigned int dirt : 1;
-	unsigned int init : 1;
 	unsigned int zero : 1;
+	unsigned int temped : 1;
+	unsigned int advice : 2;
+	unsigned int ws_window : 26;	// the working set window it was last counted in, see clear_ref
 	unsigned long disk_num;
-	struct node *clock_node;
 } page_extra_info;
 
+// PTEs per sparse page table chunk
+#define PTE_CHUNK 512
+
 typedef struct {
-	page_table_t page_table;
+	page_table_t *page_table;
+	vector<page_table_entry_t *> pt_chunks;
 	vector<page_extra_info> extra_info;
 	int top_virtual_page_num;
+	int valid_page_count;	// pages below top still valid after vm_release, its share of valid_pages
+	pid_t pid;
+	int last_fault_page;
+	int fault_stride;
+	int fault_run;
+	vector<int> swap_runs;
+	unsigned long *stats;	// counters of this pid, in pid_stats_table
+	unsigned int resident_frames;	// frames it owns, a shared frame counts for its owner only
+	unsigned int ws_refs;	// its pages found referenced in the current sampling window
+	unsigned int working_set;	// ws_refs of the last finished window
+	unsigned int min_frames;	// quota: other processes do not evict it below this, 0 = none
+	unsigned int max_frames;	// quota: at this many it replaces its own pages, 0 = none
+	bool suspended;	// load control paged it out, it is held to LOAD_CONTROL_FRAMES
+	vector<int> swapped_pages;	// pages load control paged out, read back on restore
+	pthread_mutex_t lock;	// serializes the entry points acting on it, see "concurrency"
+	pthread_mutex_t mmu_lock;	// held by the MMU translating its pages, see "concurrency"
+	page_table_t *live_table;	// sparse mode: the live page table holding its entries, 0 if none
 } proc_vm_info;
 
-map<pid_t, proc_vm_info *> vm_info;
+/**********
+concurrency: several threads may serve faults at once, each for the process it vm_switch'ed to;
+a process runs on one thread at a time
+	current_pid, current_slot and current_info are per thread
+	pager_lock guards the shared state (frames, policies, free lists, swap space, the pool,
+	page merging, quotas, load control and the trace) and is held by every entry point,
+	except while a fault's disk I/O or vm_syslog's output runs
+	free frames and swap blocks stay on the shared lists: whoever takes or gives one holds
+	pager_lock for the policy already, so per-thread caches in front of them would not take it
+	any less often; swap runs already hand each process its blocks in batches.  The statistics
+	count the takes of pager_lock ("lock") and time those that wait ("lock_wait"), which is
+	where a shared list would show up first
+	the lock of a process serializes the entry points acting on it: vm_fault, vm_extend_n,
+	vm_release, vm_advise, vm_syslog, vm_destroy and vm_fork of it as the parent; it is taken
+	before pager_lock, so vm_fork finds the parent first and checks it is still there once it
+	holds both.  A proc_vm_info is never freed (see vm_destroy), the lock it waits on stays valid
+	disk I/O of a fault runs without pager_lock, so other processes' faults go on meanwhile:
+	the victim's write-back (get_free_frame leaves it to the fault, see write_victim) and the
+	read of the page, or its zero fill after a write-back.  The page is marked resident
+	with its PTE still disabled and the frame pinned and not yet given to the policy: nothing
+	evicts, merges, cleans or reads into it, and only its own process (whose lock is held)
+	would look at the page.  The block being written is marked in flight in swap_space: a
+	fault or a read-ahead of the victim's page waits for (or skips) it, and a free of it takes
+	effect once the write is done.  The block read stays the page's disk_num and becomes its
+	temp block after the read.  Fewer than half of the private frames are ever in flight, the
+	policy keeps the rest to evict from.  Load control writes a suspended process's pages the
+	same way (see suspend_process).  The cleaner, pool spills, read-ahead, load control's
+	restore, the eviction for a copy-on-write fault and a fault for vm_syslog do their I/O under
+	pager_lock
+	vm_syslog faults in and pins the pages of a message under pager_lock, then lets go of it
+	(keeping the process lock) to wait for ring space, copy, flush or write; log_write_lock
+	keeps the lines of syslog_direct and the flusher's batches whole
+	the MMU: one serving several threads calls vm_mmu_lock (vm_pager.h), which holds mmu_lock of
+	the calling thread's current process and returns its page table, while it translates an
+	address and touches the frame.  Only the thread running a process changes its PTEs without
+	that lock (its MMU is waiting on the pager then); the pager changes another process's PTE,
+	revoking access to evict, sweep, merge or fork, under that process's mmu_lock (revoke_pte),
+	and write-protects a page before page merging compares its contents.  After that the
+	frame is the pager's until the next fault maps it again.  mmu_lock is taken last and
+	alone, never around a call into the pager
+	sparse mode: every thread has a live page table of its own (live_page_table), holding the
+	entries of the process it switched to last; switching to a process another thread ran
+	last moves its entries over
+	the trace writes a SWITCH before a record of another process than the last one traced
+**********/
+pthread_mutex_t pager_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t write_done = PTHREAD_COND_INITIALIZER;	// a write-back run without pager_lock finished
+unsigned int frames_in_flight;	// frames a fault does disk I/O on without pager_lock
 
-typedef struct {
-	pid_t pid;
-	int page_num;
-} virtual_page_indentifier;
-bool operator< (virtual_page_indentifier a, virtual_page_indentifier b) {
-	return a.pid < b.pid;
-}
+class Process_table{
+	unordered_map<pid_t, int> slot_of_pid;
+	vector<proc_vm_info *> slots;
+	vector<int> free_slots;
+public:
+	int insert(pid_t pid, proc_vm_info *info) {
+		int slot;
+		if (!free_slots.empty()) {
+			slot = free_slots.back();
+			free_slots.pop_back();
+			slots[slot] = info;
+		} else {
+			slot = slots.size();
+			slots.push_back(info);
+		}
+		slot_of_pid[pid] = slot;
+		return slot;
+	}
+	int slot(pid_t pid) {
+		unordered_map<pid_t, int>::iterator it = slot_of_pid.find(pid);
+		return it == slot_of_pid.end() ? -1 : it->second;
+	}
+	// 0 if the slot has been released
+	proc_vm_info *at(int slot) {
+		return slots[slot];
+	}
+	// slots are [0, end())
+	int end() {
+		return slots.size();
+	}
+	void erase(pid_t pid) {
+		int slot = slot_of_pid[pid];
+		slots[slot] = 0;
+		free_slots.push_back(slot);
+		slot_of_pid.erase(pid);
+	}
+};
+
+Process_table vm_info;
+
+thread_local pid_t current_pid;
+thread_local int current_slot;
+thread_local proc_vm_info *current_info;
+thread_local page_table_t *thread_page_table;	// what this thread's vm_switch set page_table_base_register to
+
+/**********
+statistics: event counters and log2 histograms, always on
+	every thread counts into its own pager_stats (registered in all_stats on first use), with
+	relaxed loads and stores instead of locked increments; the dump sums them
+	each live process also has counters of its own in pid_stats; vm_destroy adds them to
+	exited_stats and drops them, so the table only holds live pids
+	latencies are measured in stat_clock ticks: TSC cycles on x86, nanoseconds elsewhere
+	histogram bucket b counts values v with 2^(b-1) <= v < 2^b (bucket 0: v == 0)
+	pager_lock is taken through lock_pager, which counts every take and times a wait for it
+
+	VM_STATS=<file> (or - for stderr) writes everything as JSON at exit and whenever the
+	pager gets SIGUSR1 (at its next vm_switch or vm_fault)
+**********/
+enum {
+	STAT_FAULT_READ, STAT_FAULT_WRITE, STAT_FAULT_INVALID, STAT_ZERO_MAP, STAT_ZERO_FILL,
+	STAT_PAGE_IN, STAT_COW, STAT_EVICT, STAT_EVICT_TEMP_HIT, STAT_EVICT_ZERO, STAT_EVICT_WRITE,
+	STAT_DISK_READ, STAT_DISK_WRITE, STAT_CLEANER_WRITE, STAT_EXTEND, STAT_EXTEND_FAIL,
+	STAT_SWITCH, STAT_SYSLOG, STAT_FORK, STAT_DESTROY, STAT_QUOTA_LOCAL, STAT_QUOTA_RELAX,
+	STAT_SUSPEND, STAT_RESTORE, STAT_RELEASE, STAT_ADVISE, STAT_FAULT_OOM, STAT_LOCK,
+	STAT_COUNTERS
+};
+const char *stat_counter_names[STAT_COUNTERS] = {
+	"fault_read", "fault_write", "fault_invalid", "zero_map", "zero_fill",
+	"page_in", "cow", "evict", "evict_temp_hit", "evict_zero", "evict_write",
+	"disk_read", "disk_write", "cleaner_write", "extend", "extend_fail",
+	"switch", "syslog", "fork", "destroy", "quota_local", "quota_relax",
+	"suspend", "restore", "release", "advise", "fault_oom", "lock"
+};
 
-struct node{
-	struct node *next;
-	struct node *former;
-	virtual_page_indentifier vpi;
+enum {
+	HIST_FAULT_READ, HIST_FAULT_WRITE, HIST_DISK_READ, HIST_DISK_WRITE, HIST_EXTEND,
+	HIST_SWITCH, HIST_SYSLOG, HIST_FORK, HIST_DESTROY,
+	HIST_VICTIM_SCAN,	// frames whose ref bit a choose_victim cleared, plus the victim
+	HIST_LOCK_WAIT,	// ticks a take of pager_lock waited, takes that found it free are left out
+	STAT_HISTOGRAMS
 };
+const char *stat_histogram_names[STAT_HISTOGRAMS] = {
+	"fault_read", "fault_write", "disk_read", "disk_write", "extend",
+	"switch", "syslog", "fork", "destroy", "victim_scan", "lock_wait"
+};
+
+#define STAT_BUCKETS 48
+
+typedef struct {
+	unsigned long counters[STAT_COUNTERS];
+	unsigned long histograms[STAT_HISTOGRAMS][STAT_BUCKETS];
+	unsigned long long sums[STAT_HISTOGRAMS];
+} pager_stats;
+
+typedef struct {
+	unsigned long counters[STAT_COUNTERS];
+} pid_stats;
+
+vector<pager_stats *> all_stats;
+pthread_mutex_t all_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+thread_local pager_stats *thread_stats;
+unordered_map<pid_t, pid_stats> pid_stats_table;
+pid_stats exited_stats;	// summed counters of destroyed processes
+unsigned long exited_processes;
+// clear_ref calls so far, choose_victim's scan length is the difference
+unsigned long clear_ref_count;
+
+inline unsigned long long stat_clock() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
 
-class Clock_queue{
-	struct node dummy_head;
-	struct node* clock_pointer;
-	int ref_lookup(virtual_page_indentifier vpi) {
-		return vm_info[vpi.pid]->extra_info[vpi.page_num].ref;
+pager_stats *
+stats_of_thread()
+{
+	if (!thread_stats) {
+		thread_stats = (pager_stats *)calloc(1, sizeof(pager_stats));
+		pthread_mutex_lock(&all_stats_lock);
+		all_stats.push_back(thread_stats);
+		pthread_mutex_unlock(&all_stats_lock);
 	}
-	void ref_revise(virtual_page_indentifier vpi) {
-		vm_info[vpi.pid]->extra_info[vpi.page_num].ref = 0;
-		vm_info[vpi.pid]->page_table.ptes[vpi.page_num].read_enable = 0;
-		vm_info[vpi.pid]->page_table.ptes[vpi.page_num].write_enable = 0;
+	return thread_stats;
+}
+
+// one writer per counter, so no locked add; relaxed atomics keep the dump's reads well defined
+inline void stat_add(unsigned long *counter, unsigned long long value) {
+	__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+// count an event, for the process in info as well unless it is 0
+inline void stat_count(int counter, proc_vm_info *info) {
+	stat_add(&stats_of_thread()->counters[counter], 1);
+	if (info) {
+		info->stats[counter]++;
 	}
+}
+
+inline void stat_value(int histogram, unsigned long long value) {
+	pager_stats *stats = stats_of_thread();
+	int bucket = value ? 64 - __builtin_clzll(value) : 0;
+	stat_add(&stats->histograms[histogram][min(bucket, STAT_BUCKETS - 1)], 1);
+	__atomic_store_n(&stats->sums[histogram], __atomic_load_n(&stats->sums[histogram], __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+// record the ticks since start
+inline void stat_time(int histogram, unsigned long long start) {
+	stat_value(histogram, stat_clock() - start);
+}
+
+// times the scope it lives in
+class Stat_timer{
+	int histogram;
+	unsigned long long start;
 public:
-	Clock_queue(){
-		clock_pointer = &dummy_head;
-		dummy_head.next = &dummy_head;
-		dummy_head.former = &dummy_head;
+	Stat_timer(int histogram) : histogram(histogram), start(stat_clock()) {}
+	~Stat_timer() {
+		stat_time(histogram, start);
+	}
+};
+
+void
+disk_read_timed(unsigned long block, unsigned int frame)
+{
+	Stat_timer timer(HIST_DISK_READ);
+	disk_read(block, frame);
+	stat_count(STAT_DISK_READ, 0);
+}
+
+void
+disk_write_timed(unsigned long block, unsigned int frame)
+{
+	Stat_timer timer(HIST_DISK_WRITE);
+	disk_write(block, frame);
+	stat_count(STAT_DISK_WRITE, 0);
+}
+
+// take pager_lock, counting the takes and timing the ones that find it held
+void
+lock_pager()
+{
+	stat_count(STAT_LOCK, 0);
+	if (pthread_mutex_trylock(&pager_lock)) {
+		Stat_timer timer(HIST_LOCK_WAIT);
+		pthread_mutex_lock(&pager_lock);
 	}
+}
 
-	void free_node(struct node *node){
-		if (node == clock_pointer) {
-			clock_pointer = clock_pointer->next;
+// holds pager_lock, and before it the lock of info unless info is 0, for the scope it lives in
+class Pager_lock{
+	proc_vm_info *info;
+public:
+	Pager_lock(proc_vm_info *info = 0) : info(info) {
+		if (info) {
+			pthread_mutex_lock(&info->lock);
 		}
-		node->former->next = node->next;
-		node->next->former = node->former;
-		free(node);
+		lock_pager();
 	}
-	struct node *push_back(virtual_page_indentifier vpi) {
+	~Pager_lock() {
+		pthread_mutex_unlock(&pager_lock);
+		if (info) {
+			pthread_mutex_unlock(&info->lock);
+		}
+	}
+	// let go of pager_lock for a while, the lock of info stays held
+	void drop() {
+		pthread_mutex_unlock(&pager_lock);
+	}
+	void retake() {
+		lock_pager();
+	}
+};
+
+/**********
+lz4: the LZ4 block format, compressor and decompressor
+	a block is a run of sequences: a token (literal length in the high nibble, match length
+	less 4 in the low one, 15 meaning more length bytes follow, each adding up to 255), the
+	literals, then a 2-byte little-endian offset back to the match
+	the last sequence has literals only; the last match starts LZ4_MFLIMIT bytes before the end
+	and ends LZ4_LASTLITERALS bytes before it, so output decodes with any LZ4 decoder
+**********/
+#define LZ4_HASH_BITS 12
+#define LZ4_MINMATCH 4
+#define LZ4_MFLIMIT 12
+#define LZ4_LASTLITERALS 5
 
-		struct node *node = (struct node *)calloc(1, sizeof(struct node));
-		node->former = dummy_head.former;
-		node->next = &dummy_head;
-		node->vpi = vpi;
-		dummy_head.former->next = node;
-		dummy_head.former = node;
-		return node;
+inline unsigned int lz4_read32(const unsigned char *p) {
+	unsigned int v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+inline unsigned int lz4_hash(unsigned int sequence) {
+	return (sequence * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+// write length above 15 as the extra length bytes of a token
+inline unsigned char *lz4_write_length(unsigned char *op, unsigned int length) {
+	for (length -= 15; length >= 255; length -= 255) {
+		*op++ = 255;
 	}
+	*op++ = length;
+	return op;
+}
 
-	virtual_page_indentifier get_victim(){
-		while (1){
-			
-			// skip dummy head
-			if (clock_pointer == &dummy_head) {
-				clock_pointer = clock_pointer->next;
-				continue;
-			}
-			
-			// if the process has exited free the item
-			
-			if (vm_info.count(clock_pointer->vpi.pid) == 0) {
-			
-				clock_pointer->former->next = clock_pointer->next;
-				clock_pointer->next->former = clock_pointer->former;
-				struct node *to_del = clock_pointer;
-				clock_pointer = clock_pointer->next;
-				free(to_del);
-				continue;
-			}
-			
-			// lookup and set 0 ref bit
-			if (!ref_lookup(clock_pointer->vpi)) {
-				break;
-			}
-			ref_revise(clock_pointer->vpi);
-			clock_pointer = clock_pointer->next;
+// compressed size, 0 if it would not fit in capacity bytes
+int
+lz4_compress(const unsigned char *src, int size, unsigned char *dst, int capacity)
+{
+	// 1 + position of the last sequence hashed to each slot, 0 for none
+	unsigned short table[1 << LZ4_HASH_BITS];
+	memset(table, 0, sizeof(table));
+	const unsigned char *ip = src, *anchor = src;
+	const unsigned char *mflimit = src + size - LZ4_MFLIMIT;
+	const unsigned char *matchlimit = src + size - LZ4_LASTLITERALS;
+	unsigned char *op = dst, *oend = dst + capacity;
+	unsigned int misses = 0;
+	while (size > LZ4_MFLIMIT && ip < mflimit) {
+		unsigned int sequence = lz4_read32(ip);
+		unsigned int h = lz4_hash(sequence);
+		unsigned int candidate = table[h];
+		table[h] = ip - src + 1;
+		const unsigned char *ref = src + candidate - (candidate != 0);
+		if (!candidate || ip - ref > 65535 || lz4_read32(ref) != sequence) {
+			// the longer nothing matches the faster it skips, like LZ4's acceleration
+			ip += 1 + (misses++ >> 6);
+			continue;
 		}
-
-		// remove victim out of the queue
-		clock_pointer->former->next = clock_pointer->next;
-		clock_pointer->next->former = clock_pointer->former;
-		virtual_page_indentifier victim = clock_pointer->vpi;
-		struct node *to_del = clock_pointer;
-		clock_pointer = clock_pointer->next;
-		free(to_del);
-		return victim;
+		misses = 0;
+		const unsigned char *match_end = ip + LZ4_MINMATCH;
+		while (match_end < matchlimit && *match_end == ref[match_end - ip]) {
+			match_end++;
+		}
+		unsigned int literals = ip - anchor, match = match_end - ip - LZ4_MINMATCH;
+		if (op + 1 + literals / 255 + 1 + literals + 2 + match / 255 + 1 > oend) {
+			return 0;
+		}
+		unsigned char *token = op++;
+		*token = (literals >= 15 ? 15 : literals) << 4;
+		if (literals >= 15) {
+			op = lz4_write_length(op, literals);
+		}
+		memcpy(op, anchor, literals);
+		op += literals;
+		unsigned int offset = ip - ref;
+		*op++ = offset & 0xff;
+		*op++ = offset >> 8;
+		*token |= match >= 15 ? 15 : match;
+		if (match >= 15) {
+			op = lz4_write_length(op, match);
+		}
+		ip = anchor = match_end;
+	}
+	unsigned int literals = src + size - anchor;
+	if (op + 1 + literals / 255 + 1 + literals > oend) {
+		return 0;
+	}
+	*op++ = (literals >= 15 ? 15 : literals) << 4;
+	if (literals >= 15) {
+		op = lz4_write_length(op, literals);
 	}
+	memcpy(op, anchor, literals);
+	op += literals;
+	return op - dst;
+}
 
-	void inspect() {
-		struct node *node = dummy_head.next;
-		while (node != &dummy_head) {
-			cout << "page_num: " <<node->vpi.page_num << "ref: " << ref_lookup(node->vpi) <<"ooooo\n";
-			node = node->next;
+// decompressed size, -1 if src is not a valid block or does not fit in capacity bytes
+int
+lz4_decompress(const unsigned char *src, int size, unsigned char *dst, int capacity)
+{
+	const unsigned char *ip = src, *iend = src + size;
+	unsigned char *op = dst, *oend = dst + capacity;
+	while (ip < iend) {
+		unsigned int token = *ip++;
+		unsigned int literals = token >> 4;
+		if (literals == 15) {
+			unsigned int b;
+			do {
+				if (ip >= iend) {
+					return -1;
+				}
+				b = *ip++;
+				literals += b;
+			} while (b == 255);
+		}
+		if (literals > (unsigned long)(iend - ip) || literals > (unsigned long)(oend - op)) {
+			return -1;
+		}
+		memcpy(op, ip, literals);
+		op += literals;
+		ip += literals;
+		if (ip == iend) {
+			break;
 		}
+		if (iend - ip < 2) {
+			return -1;
+		}
+		unsigned int offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		unsigned int match = (token & 15) + LZ4_MINMATCH;
+		if ((token & 15) == 15) {
+			unsigned int b;
+			do {
+				if (ip >= iend) {
+					return -1;
+				}
+				b = *ip++;
+				match += b;
+			} while (b == 255);
+		}
+		if (offset == 0 || offset > (unsigned long)(op - dst) || match > (unsigned long)(oend - op)) {
+			return -1;
+		}
+		// byte by byte: the match may overlap what it produces
+		const unsigned char *ref = op - offset;
+		for (unsigned int i = 0; i < match; i++) {
+			op[i] = ref[i];
+		}
+		op += match;
 	}
-};
+	return op - dst;
+}
 
-Clock_queue *clock_queue;
+/**********
+compressed pool (VM_ZSWAP=<percent of the private frames>, off by default): a write-back
+cache of compressed blocks in front of the disk
+	its frames come off the top of the private frames at vm_init, plus a bounce frame
+	write_block compresses the page into the pool instead of writing the disk, unless it
+	does not shrink to 3/4 of a page; read_block looks in the pool before the disk.  So every
+	page on "disk" still has its block, and the capacity limit holds unchanged.
+	the pool is a log: records (block, length, lz4 data) are appended at pool_head, a newer
+	copy of a block or a freed block leaves a dead record behind; when the log is full the
+	oldest (coldest) POOL_BATCH live records at pool_tail are decompressed into the bounce
+	frame and written to their blocks, sorted by block, and the tail moves past them
+	pool_index: block -> log position of its live record
+**********/
+#define POOL_BATCH 16
+#define POOL_PAD 0xffffffffU
 
-map<virtual_page_indentifier, unsigned long> temp_disk_block_map;
+typedef struct {
+	unsigned int block;	// POOL_PAD: nothing up to the end of the log
+	unsigned int len;	// bytes of lz4 data that follow
+} pool_record;
 
-pid_t current_pid;
+char *pool_base;
+unsigned long pool_size;
+unsigned long pool_head, pool_tail;	// log positions, the byte is at position % pool_size
+unsigned int pool_frames;
+unsigned int pool_bounce;
+unordered_map<unsigned long, unsigned long> pool_index;
+unsigned char pool_scratch[VM_PAGESIZE];
 
+struct {
+	unsigned long stored;
+	unsigned long rejected;
+	unsigned long loads;
+	unsigned long spilled;
+	unsigned long live_bytes;
+} pool_stats;
 
+inline pool_record *pool_record_at(unsigned long position) {
+	return (pool_record *)(pool_base + position % pool_size);
+}
 
-/**********
-fuction definition
+inline unsigned long pool_record_size(pool_record *r) {
+	return (sizeof(pool_record) + r->len + 7) & ~7UL;
+}
 
-vm_init: Make a linked list of memory_pages and disk_blocks
+void
+pool_init(unsigned int first_frame, unsigned int frames)
+{
+	pool_frames = frames;
+	pool_base = (char *)pm_physmem + (unsigned long)first_frame * VM_PAGESIZE;
+	pool_size = (unsigned long)frames * VM_PAGESIZE;
+	pool_bounce = first_frame + frames;
+	pool_index.reserve(frames * 4);
+}
 
-vm_create(pid): create vm info of this process
+// the block was freed or rewritten: its record is dead
+void
+pool_drop(unsigned long block)
+{
+	unordered_map<unsigned long, unsigned long>::iterator it = pool_index.find(block);
+	if (it != pool_index.end()) {
+		pool_stats.live_bytes -= pool_record_size(pool_record_at(it->second));
+		pool_index.erase(it);
+	}
+}
 
-vm_switch(pid): set current_pid and page_table_register
-**********/
+bool
+pool_record_less(const pair<unsigned long, unsigned long> &a, const pair<unsigned long, unsigned long> &b)
+{
+	return a.first < b.first;
+}
 
-void 
-vm_init(unsigned int memory_pages, unsigned int disk_blocks)
+// write the oldest live records to disk and move the tail past them
+void
+pool_spill()
 {
-	for (int i = 0; i < memory_pages; i++) {
-		free_phy_mem_page_list.push_back(i);
+	static vector<pair<unsigned long, unsigned long> > batch;	// block, position
+	batch.clear();
+	unsigned long position = pool_tail;
+	while (position != pool_head && batch.size() < POOL_BATCH) {
+		pool_record *r = pool_record_at(position);
+		if (r->block == POOL_PAD) {
+			position += r->len;
+			continue;
+		}
+		unordered_map<unsigned long, unsigned long>::iterator it = pool_index.find(r->block);
+		if (it != pool_index.end() && it->second == position) {
+			batch.push_back(make_pair((unsigned long)r->block, position));
+		}
+		position += pool_record_size(r);
 	}
-	for (int i = 0; i < disk_blocks; i++) {
-		free_disk_block_list.push_back(i);
+	sort(batch.begin(), batch.end(), pool_record_less);
+	unsigned char *bounce = (unsigned char *)pm_physmem + (unsigned long)pool_bounce * VM_PAGESIZE;
+	for (unsigned int i = 0; i < batch.size(); i++) {
+		pool_record *r = pool_record_at(batch[i].second);
+		lz4_decompress((unsigned char *)(r + 1), r->len, bounce, VM_PAGESIZE);
+		disk_write_timed(batch[i].first, pool_bounce);
+		pool_drop(batch[i].first);
+		pool_stats.spilled++;
 	}
+	pool_tail = position;
+}
 
-	clock_queue = new Clock_queue;
+// store the page in frame as the content of block; false if it does not compress well enough
+bool
+pool_put(unsigned long block, unsigned int frame)
+{
+	int len = lz4_compress((unsigned char *)pm_physmem + (unsigned long)frame * VM_PAGESIZE, VM_PAGESIZE,
+		pool_scratch, VM_PAGESIZE * 3 / 4);
+	pool_drop(block);
+	if (!len) {
+		pool_stats.rejected++;
+		return false;
+	}
+	unsigned long need = (sizeof(pool_record) + len + 7) & ~7UL;
+	unsigned long pad;
+	while (1) {
+		if (pool_head == pool_tail) {
+			pool_head = pool_tail = 0;
+		}
+		unsigned long offset = pool_head % pool_size;
+		pad = offset + need > pool_size ? pool_size - offset : 0;
+		if (pool_size - (pool_head - pool_tail) >= need + pad) {
+			break;
+		}
+		pool_spill();
+	}
+	if (pad) {
+		pool_record *r = pool_record_at(pool_head);
+		r->block = POOL_PAD;
+		r->len = pad;
+		pool_head += pad;
+	}
+	pool_record *r = pool_record_at(pool_head);
+	r->block = block;
+	r->len = len;
+	memcpy(r + 1, pool_scratch, len);
+	pool_index[block] = pool_head;
+	pool_head += need;
+	pool_stats.stored++;
+	pool_stats.live_bytes += need;
+	return true;
 }
 
-void 
-vm_create(pid_t pid)
+// copy the content of block into frame if the pool has it
+bool
+pool_get(unsigned long block, unsigned int frame)
 {
-	proc_vm_info *info = (proc_vm_info *)calloc(1, sizeof(proc_vm_info));
-	vm_info[pid] = info;
-	
+	unordered_map<unsigned long, unsigned long>::iterator it = pool_index.find(block);
+	if (it == pool_index.end()) {
+		return false;
+	}
+	pool_record *r = pool_record_at(it->second);
+	lz4_decompress((unsigned char *)(r + 1), r->len, (unsigned char *)pm_physmem + (unsigned long)frame * VM_PAGESIZE, VM_PAGESIZE);
+	pool_stats.loads++;
+	return true;
 }
 
-void 
-vm_switch(pid_t pid)
+void
+read_block(unsigned long block, unsigned int frame)
 {
-	
-	current_pid = pid;
-	page_table_base_register = &(vm_info[pid]->page_table);
+	if (pool_size && pool_get(block, frame)) {
+		return;
+	}
+	disk_read_timed(block, frame);
 }
 
-/**********
-vm_extend()
-	if there is free physical memory:
-		pop free_phy_mem_list and add its page_num to pte of top_vm_page
-		set new page extra_info: val=1, res=1, ref=0, dirt=0, new=1, zero=1, disk_num=0
-		add (pid, top_vm_page) to clock queue
-		update top_vm_page
-		return new top_vm_page
-	else if there is free disk block:
-		set new page (via top_vm_page) extra_info: val=1, res=0, ref=0, dirt=0, new=1, zero=1
-		pop free_disk_block_list add its block_num to extra_info.disk_num
-		update top_vm_page
-		return new top_vm_page
-	else if there is temp disk block (!temp_disk_block_map.empty()):
-		set new page (via top_vm_page) extra_info: val=1, res=0, ref=0, dirt=0, new=1, zero=1
-		pop temp_disk_block_map and add its block_num to extra_info.disk_num
-		update top_vm_page
-		return new top_vm_page
-	else:
-		no avail mem or disk
-		return 0
-**********/
-void * 
-vm_extend()
+void
+write_block(unsigned long block, unsigned int frame)
 {
-	void *return_addr = 0;
-	proc_vm_info *info = vm_info[current_pid];
-	if (!free_phy_mem_page_list.empty()) {
-		virtual_page_indentifier vpi = {current_pid, info->top_virtual_page_num};
+	if (pool_size && pool_put(block, frame)) {
+		return;
+	}
+	disk_write_timed(block, frame);
+}
 
-		info->page_table.ptes[info->top_virtual_page_num].ppage=free_phy_mem_page_list.back();
+// set from VM_SPARSE_PAGE_TABLE in vm_init
+bool sparse_page_table;
+thread_local page_table_t *live_page_table;	// this thread's, allocated by its first vm_switch
+thread_local proc_vm_info *live_info;	// whose entries live_page_table held last
 
-		// val=1, res=1, ref=0, dirt=0, new=1, zero=1, disk_num=0
-		page_extra_info ei = {1,1,0,0,1,1,0,clock_queue->push_back(vpi)};
-		info->extra_info.push_back(ei);
+page_table_entry_t *pte_of(proc_vm_info *info, unsigned long page_num) {
+	if (!sparse_page_table) {
+		return &info->page_table->ptes[page_num];
+	}
+	if (info->live_table) {
+		return &info->live_table->ptes[page_num];
+	}
+	return &info->pt_chunks[page_num / PTE_CHUNK][page_num % PTE_CHUNK];
+}
 
-		free_phy_mem_page_list.pop_back();
+// copy the materialized chunks of info between its live table and its pt_chunks
+// the table may be another thread's, whose MMU could be reading it
+void swap_out_page_table(proc_vm_info *info) {
+	pthread_mutex_lock(&info->mmu_lock);
+	for (unsigned int c = 0; c < info->pt_chunks.size(); c++) {
+		memcpy(info->pt_chunks[c], &info->live_table->ptes[c * PTE_CHUNK], PTE_CHUNK * sizeof(page_table_entry_t));
+		memset(&info->live_table->ptes[c * PTE_CHUNK], 0, PTE_CHUNK * sizeof(page_table_entry_t));
+	}
+	info->live_table = 0;
+	pthread_mutex_unlock(&info->mmu_lock);
+}
+void swap_in_page_table(proc_vm_info *info) {
+	for (unsigned int c = 0; c < info->pt_chunks.size(); c++) {
+		memcpy(&live_page_table->ptes[c * PTE_CHUNK], info->pt_chunks[c], PTE_CHUNK * sizeof(page_table_entry_t));
+	}
+	info->live_table = live_page_table;
+}
+
+// revoke access to a page of a process another thread may be running, see "concurrency"
+void
+revoke_pte(proc_vm_info *info, unsigned long page_num, bool write_only = false)
+{
+	pthread_mutex_lock(&info->mmu_lock);
+	page_table_entry_t *pte = pte_of(info, page_num);
+	pte->write_enable = 0;
+	if (!write_only) {
+		pte->read_enable = 0;
+	}
+	pthread_mutex_unlock(&info->mmu_lock);
+}
 
+// point a page of a process another thread may be running at ppage, read-only or disabled
+void
+map_pte(proc_vm_info *info, unsigned long page_num, unsigned int ppage, bool read_enable)
+{
+	pthread_mutex_lock(&info->mmu_lock);
+	page_table_entry_t *pte = pte_of(info, page_num);
+	pte->ppage = ppage;
+	pte->read_enable = read_enable;
+	pte->write_enable = 0;
+	pthread_mutex_unlock(&info->mmu_lock);
+}
+
+typedef struct {
+	int slot;
+	int page_num;
+} virtual_page_indentifier;
 
-		return_addr = (void*)((char*)VM_ARENA_BASEADDR + VM_PAGESIZE*info->top_virtual_page_num);
-		info->top_virtual_page_num += 1;
+// 16 bytes, so a cache line holds four frames of the clock ring
+typedef struct {
+	int slot;
+	unsigned int page_num : 16;
+	unsigned int ref : 1;
+	unsigned int dirt : 1;
+	unsigned int pinned : 11;
+	unsigned int prefetched : 1;
+	unsigned int in_use : 1;
+	unsigned int shared : 1;
+	unsigned int next;
+	unsigned int former;
+} frame_info;
 
-	} else if (!free_disk_block_list.empty()) {
-		// val=1, res=0, ref=0, dirt=0, new=1, zero=1, disk_num=..back()
-		page_extra_info ei = {1,0,0,0,1,1,free_disk_block_list.back(),0};
-		info->extra_info.push_back(ei);
+frame_info *frame_table;
 
-		free_disk_block_list.pop_back();
+// key: pid in the high 32 bits, virtual page number in the low 32 bits
+inline unsigned long long page_key(pid_t pid, unsigned long page_num) {
+	return ((unsigned long long)(unsigned int)pid << 32) | (unsigned int)page_num;
+}
 
-		return_addr = (void*)((char*)VM_ARENA_BASEADDR + VM_PAGESIZE*info->top_virtual_page_num);
-		info->top_virtual_page_num += 1;
+unsigned long long frame_key(unsigned int frame) {
+	return page_key(vm_info.at(frame_table[frame].slot)->pid, frame_table[frame].page_num);
+}
 
-	} else if (!temp_disk_block_map.empty()) {
-		virtual_page_indentifier vpi = temp_disk_block_map.begin()->first;
+// every page mapping a shared frame, the owner first
+unordered_map<unsigned int, vector<virtual_page_indentifier> > frame_sharers;
 
-		// val=1, res=0, ref=0, dirt=0, new=1, zero=1, disk_num=..second
-		page_extra_info ei = {1,0,0,0,1,1,temp_disk_block_map.begin()->second,0};
-		info->extra_info.push_back(ei);
+/**********
+working sets and quotas
+	working set: the policies clear ref bits as they sweep, each cleared bit is a page used
+		since the sweep last passed it; ws_refs counts the distinct pages per process (a
+		page remembers the window it was counted in), and once private_pages bits have
+		been cleared (about one sweep of memory) the window closes and working_set takes
+		ws_refs.  Without memory pressure nothing is swept and a process's working set is
+		just its resident frames.
+	quotas (vm_set_quota): min_frames and max_frames per process, 0 for none
+		a process at max_frames takes its frames from its own pages, even when frames are free,
+		as long as it owns more frames than are pinned and a disk block is free; it does not read ahead
+		a process at or below min_frames loses frames only to its own faults
+		the mins add up to less than private_pages
+	choose_victim asks evictable() about every candidate.  The min_frames filter is soft: after
+	2 * private_pages refusals in a row, with no ref bit cleared and no page demoted in between
+	(about two sweeps finding nothing), it lets everything unpinned through, so a policy never
+	spins when pins or quotas leave nothing else.  The max_frames one is hard: the process owns
+	more frames than are pinned, so some frame of its own is unpinned, and every policy comes
+	to it once it has cleared its ref bit.
+**********/
+unsigned long ws_window_start;
+unsigned long ws_windows;
+unsigned int min_frames_total;
 
-		temp_disk_block_map.erase(vpi);
+// pins outstanding, a frame pinned twice counts twice
+unsigned int pinned_frames;
 
-		return_addr = (void*)((char*)VM_ARENA_BASEADDR + VM_PAGESIZE*info->top_virtual_page_num);
-		info->top_virtual_page_num += 1;
+// quota filter for the eviction in progress
+bool quota_active;
+int quota_local_slot = -1;
+unsigned long quota_refused;
 
+// a page of info was found referenced: count it once in the current window
+void
+ws_sample(proc_vm_info *info, unsigned long page_num)
+{
+	page_extra_info *ei = &info->extra_info[page_num];
+	unsigned int window = (ws_windows + 1) & ((1 << 26) - 1);
+	if (ei->ws_window != window) {
+		ei->ws_window = window;
+		info->ws_refs++;
 	}
-	
-	return return_addr;
+}
 
+// clear the ref bit and revoke access so the next touch faults and sets it again
+// a set ref bit is also a working set sample for every page mapping the frame
+void clear_ref(unsigned int frame) {
+	frame_info *fi = &frame_table[frame];
+	fi->ref = 0;
+	clear_ref_count++;
+	// the policy is getting somewhere, see evictable
+	quota_refused = 0;
+	if (fi->shared) {
+		vector<virtual_page_indentifier> &pages = frame_sharers[frame];
+		for (unsigned int i = 0; i < pages.size(); i++) {
+			proc_vm_info *info = vm_info.at(pages[i].slot);
+			ws_sample(info, pages[i].page_num);
+			revoke_pte(info, pages[i].page_num);
+		}
+		return;
+	}
+	proc_vm_info *info = vm_info.at(fi->slot);
+	ws_sample(info, fi->page_num);
+	revoke_pte(info, fi->page_num);
 }
-/**********
-vm_destroy()
-	for each valid page in current process
-		if it is resident
-			return its ppage to free_list
-			delete its clock node
-			if it is temped
-				delete it in temp-map
-				return disk_page to free_list
-		if it is non-resident
-			return its disk block to free_list
-	free its proc_vm_info
-***********/
-void 
-vm_destroy()
+
+
+void
+ws_roll()
 {
-	proc_vm_info *info = vm_info[current_pid];
-	for (int i = 0; i < info->top_virtual_page_num; i++) {
-		if (info->extra_info[i].res) {
-			free_phy_mem_page_list.push_back(info->page_table.ptes[i].ppage);
-			// if in temp?
-			virtual_page_indentifier vpi = {current_pid, i};
-			clock_queue->free_node(info->extra_info[i].clock_node);
-			
-			if (temp_disk_block_map.count(vpi)){
-				free_disk_block_list.push_back(temp_disk_block_map[vpi]);
-				temp_disk_block_map.erase(vpi);
-			}
-		} else {
-			free_disk_block_list.push_back(info->extra_info[i].disk_num);
+	for (int slot = 0; slot < vm_info.end(); slot++) {
+		proc_vm_info *info = vm_info.at(slot);
+		if (info) {
+			info->working_set = info->ws_refs;
+			info->ws_refs = 0;
 		}
 	}
-	free(info);
-	vm_info.erase(current_pid);
-	
-	clock_queue->inspect();
-	
+	ws_window_start = clear_ref_count;
+	ws_windows++;
 }
 
-int 
-vm_fault(void *addr, bool write_flag)
+bool
+evictable(unsigned int frame)
 {
-	unsigned long page_number = ((unsigned long)addr - (unsigned long)VM_ARENA_BASEADDR) / VM_PAGESIZE;
-	proc_vm_info *info = vm_info[current_pid];
-	virtual_page_indentifier vpi = {current_pid, page_number};
-	page_extra_info ei = info->extra_info[page_number];
-	/*
-	printf("faulting addr is %p, which is page %ld:\n",addr,page_number);
-	if (write_flag)
-		printf("fault is cause by write\n");
-	else
-		printf("fault is cause by read\n");
-	printf("fault flags are valid:%d,res:%d,ref:%d,dirt:%d,init:%d,zero:%d\n",ei.val ,ei.res,ei.ref,ei.dirt,ei.init,ei.zero);
-	*/
-	if (!ei.val) {
-		return -1;
+	frame_info *fi = &frame_table[frame];
+	if (fi->pinned) {
+		return false;
 	}
-	if (!ei.res) {
-		
-		// get a free memory page
-		//     there is free mem
-		//     find a victim, evict it thus get a free mem 
-		// if page-in page's zero bit is set
-		//     set init bit 1
-		// else
-		//     disk read
-		//     add disk_num to temp-map
-		// write free mem to its pte
-		// set res = 1
-		unsigned long free_page;
-		if (!free_phy_mem_page_list.empty()) {
-			free_page = free_phy_mem_page_list.back();
-			free_phy_mem_page_list.pop_back();
-		} else {
-			// set victim's !res !read and !write
-			// get victim's phy_mem page
-			// if victim is temped 
-			//     remove it from temp-map
-			// if victim is 0 page
-			//     do nothing
-			// if there is free disk
-			//     wrtie disk and set disk_num of victim
-			// else
-			//     find a block in temp-map remove it, write disk and set disk num of victim
-			
-			//clock_queue->inspect();
-			virtual_page_indentifier victim = clock_queue->get_victim();
-			
-			proc_vm_info *victim_info = vm_info[victim.pid];
-			victim_info->extra_info[victim.page_num].res = 0;
-			victim_info->page_table.ptes[victim.page_num].write_enable = 0;
-			victim_info->page_table.ptes[victim.page_num].read_enable = 0;
-			free_page = victim_info->page_table.ptes[victim.page_num].ppage;
-			
-			if (temp_disk_block_map.count(victim)) {
-				temp_disk_block_map.erase(victim);
+	if (!quota_active) {
+		return true;
+	}
+	proc_vm_info *owner = vm_info.at(fi->slot);
+	bool allowed = quota_local_slot >= 0 ? fi->slot == quota_local_slot
+		: fi->slot == current_slot || owner->resident_frames > owner->min_frames;
+	if (allowed) {
+		return true;
+	}
+	if (quota_local_slot < 0 && ++quota_refused > 2 * private_pages) {
+		quota_active = false;
+		stat_count(STAT_QUOTA_RELAX, current_info);
+		return true;
+	}
+	return false;
+}
 
-			} else if (victim_info->extra_info[victim.page_num].zero) {
+void
+pin_frame(unsigned int frame)
+{
+	frame_table[frame].pinned++;
+	pinned_frames++;
+}
 
-			} else if (!free_disk_block_list.empty()) {
-				victim_info->extra_info[victim.page_num].disk_num = free_disk_block_list.back();
-				disk_write(free_disk_block_list.back(), free_page);
-				free_disk_block_list.pop_back();
+void
+unpin_frame(unsigned int frame)
+{
+	frame_table[frame].pinned--;
+	pinned_frames--;
+}
 
-			} else {
-				victim_info->extra_info[victim.page_num].disk_num = temp_disk_block_map.begin()->second;
-				temp_disk_block_map.erase(temp_disk_block_map.begin()->first);
-				disk_write(victim_info->extra_info[victim.page_num].disk_num, free_page);
-			}
+// frame_table entries past memory_pages are dummy heads for Frame_rings
+#define FRAME_RING_HEADS 4
 
-		}
+// circular list of frames threaded through frame_table, frame_table[head] is its dummy
+class Frame_ring{
+	unsigned int head;
+	unsigned int count;
+public:
+	void init(unsigned int dummy) {
+		head = dummy;
+		count = 0;
+		frame_table[head].next = head;
+		frame_table[head].former = head;
+	}
+	bool empty() {
+		return count == 0;
+	}
+	unsigned int size() {
+		return count;
+	}
+	unsigned int end() {
+		return head;
+	}
+	unsigned int front() {
+		return frame_table[head].next;
+	}
+	void push_back(unsigned int frame) {
+		frame_table[frame].former = frame_table[head].former;
+		frame_table[frame].next = head;
+		frame_table[frame_table[head].former].next = frame;
+		frame_table[head].former = frame;
+		count++;
+	}
+	void remove(unsigned int frame) {
+		frame_table[frame_table[frame].former].next = frame_table[frame].next;
+		frame_table[frame_table[frame].next].former = frame_table[frame].former;
+		count--;
+	}
+};
 
-		if (info->extra_info[page_number].zero) {
-			info->extra_info[page_number].init = 1;
-			free_disk_block_list.push_back(info->extra_info[page_number].disk_num);
-		} else {
-			temp_disk_block_map[vpi] = info->extra_info[page_number].disk_num;
-			disk_read(info->extra_info[page_number].disk_num ,free_page);
+// bounded history of evicted pages, oldest at the front
+class Ghost_list{
+	list<unsigned long long> order;
+	unordered_map<unsigned long long, list<unsigned long long>::iterator> index;
+public:
+	unsigned int size() {
+		return order.size();
+	}
+	bool contains(unsigned long long key) {
+		return index.count(key) != 0;
+	}
+	void push_back(unsigned long long key) {
+		erase(key);
+		order.push_back(key);
+		index[key] = --order.end();
+	}
+	bool erase(unsigned long long key) {
+		unordered_map<unsigned long long, list<unsigned long long>::iterator>::iterator it = index.find(key);
+		if (it == index.end()) {
+			return false;
 		}
-		info->page_table.ptes[page_number].ppage = free_page;
-		info->extra_info[page_number].clock_node = clock_queue->push_back(vpi);
-
+		order.erase(it->second);
+		index.erase(it);
+		return true;
 	}
-	ei = info->extra_info[page_number];
-	if (write_flag) {
-		page_extra_info new_ei = {1,1,1,1,0,0,ei.disk_num,ei.clock_node};
-		info->page_table.ptes[page_number].write_enable = 1;
-		info->page_table.ptes[page_number].read_enable = 1;
+	unsigned long long pop_front() {
+		unsigned long long key = order.front();
+		index.erase(key);
+		order.pop_front();
+		return key;
+	}
+};
 
-		if (temp_disk_block_map.count(vpi)){
-			free_disk_block_list.push_back(temp_disk_block_map[vpi]);
-			temp_disk_block_map.erase(vpi);
+/**********
+log sink: where vm_syslog output goes, standard output or VM_SYSLOG_FILE
+	by default vm_syslog copies each line into log_buffer before it returns (syslog_direct);
+	the buffer is written out with the line that does not fit in it, in one writev, and at
+	vm_destroy and exit, so a line costs a system call only every LOG_BUFFER_SIZE bytes
+	with VM_SYSLOG_RING set, vm_syslog copies each message into log_ring instead, and a flusher
+	thread writes the ring out with writev in batches of up to LOG_BATCH records, so page-fault
+	service never waits on the output; lines of different processes may then come out after
+	output the processes wrote themselves later
+	log_ring: log_ring_size bytes (a power of two) of records, a log_record header followed by
+		the line, padded to 8 bytes; a record that would cross the end of the ring is preceded
+		by a pad record filling the rest
+	producers reserve space by advancing log_head with a compare-and-swap and publish a record
+	by storing its state word last, so several threads can log at once; only the flusher moves
+	log_tail, and it zeroes the space it gives back so stale bytes never look published
+	when the ring is full vm_syslog waits for the flusher, or drops the message and counts it
+	a message that does not fit in the ring at all is written directly once the ring has drained
+
+	VM_SYSLOG_RING: ring bytes (default 0, no ring: every message goes through log_buffer)
+	VM_SYSLOG_FULL: block (default) or drop
+	VM_SYSLOG_FILE: append to this file instead of standard output
+	VM_SYSLOG_STAMP=1: start each line with the time and pid the record was logged with
+	VM_SYSLOG_STATS=1: print logged and dropped counts to stderr at exit
+**********/
+#define LOG_READY 0x80000000u
+#define LOG_PAD 0x40000000u
+#define LOG_SIZE_MASK 0x3fffffffu
+#define LOG_BATCH 256
+#define LOG_IOVECS 64
+#define LOG_BUFFER_SIZE 65536
+#define LOG_STAMP_SIZE 48
+
+typedef struct {
+	unsigned int state;		// record bytes | LOG_READY | LOG_PAD, 0 until published
+	unsigned int len;		// bytes of the line
+	pid_t pid;
+	unsigned int unused;
+	unsigned long long timestamp;	// ns since the epoch
+} log_record;
+
+int log_fd = 1;
+char *log_ring;
+unsigned long log_ring_size;
+atomic<unsigned long> log_head;
+atomic<unsigned long> log_tail;
+bool log_drop;
+bool log_stamp;
+bool log_flusher_running;
+pthread_t log_flusher;
+pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_mutex_t log_write_lock = PTHREAD_MUTEX_INITIALIZER;	// one writer of lines at a time, see syslog_direct
+char log_buffer[LOG_BUFFER_SIZE];	// lines not written yet, without a ring; under log_write_lock
+unsigned int log_used;
+pthread_cond_t log_wakeup = PTHREAD_COND_INITIALIZER;	// records published, or stopping
+pthread_cond_t log_space = PTHREAD_COND_INITIALIZER;	// the flusher gave space back
+atomic<bool> log_flusher_idle;
+atomic<bool> log_stopping;
+
+struct {
+	atomic<unsigned long> records;
+	atomic<unsigned long> bytes;
+	atomic<unsigned long> dropped_records;
+	atomic<unsigned long> dropped_bytes;
+} log_stats;
+
+unsigned long long
+log_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int
+log_format_stamp(char *stamp, unsigned long long timestamp, pid_t pid)
+{
+	return snprintf(stamp, LOG_STAMP_SIZE, "[%llu.%06llu %d] ", timestamp / 1000000000ULL,
+		timestamp % 1000000000ULL / 1000, (int)pid);
+}
+
+// writev every byte of iov, retrying short writes
+void
+log_writev(struct iovec *iov, int count)
+{
+	while (count > 0) {
+		ssize_t n = writev(log_fd, iov, count);
+		if (n < 0) {
+			return;
+		}
+		while (count > 0 && (size_t)n >= iov->iov_len) {
+			n -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base = (char *)iov->iov_base + n;
+			iov->iov_len -= n;
+		}
+	}
+}
+
+// copy iov[1..count) into log_buffer if it fits and there is no ring, whose lines would pass it
+bool
+log_append(struct iovec *iov, int count)
+{
+	size_t total = 0;
+	for (int i = 1; i < count; i++) {
+		total += iov[i].iov_len;
+	}
+	if (log_flusher_running || log_used + total > LOG_BUFFER_SIZE) {
+		return false;
+	}
+	for (int i = 1; i < count; i++) {
+		memcpy(log_buffer + log_used, iov[i].iov_base, iov[i].iov_len);
+		log_used += iov[i].iov_len;
+	}
+	return true;
+}
+
+// write log_buffer and iov[1..count) in one writev; iov[0] is left free for the buffered bytes
+void
+log_write(struct iovec *iov, int count)
+{
+	iov[0].iov_base = log_buffer;
+	iov[0].iov_len = log_used;
+	log_writev(iov, count);
+	log_used = 0;
+}
+
+// write out log_buffer, at vm_destroy and exit
+void
+log_write_buffer()
+{
+	struct iovec iov;
+	pthread_mutex_lock(&log_write_lock);
+	if (log_used) {
+		log_write(&iov, 1);
+	}
+	pthread_mutex_unlock(&log_write_lock);
+}
+
+log_record *
+log_record_at(unsigned long position)
+{
+	return (log_record *)(log_ring + (position & (log_ring_size - 1)));
+}
+
+void *
+log_flusher_main(void *)
+{
+	struct iovec iov[2 * LOG_BATCH];
+	char stamps[LOG_BATCH][LOG_STAMP_SIZE];
+	unsigned long tail = log_tail.load();
+	while (1) {
+		int count = 0, records = 0;
+		unsigned long end = tail;
+		// a full ring ends where it starts
+		while (records < LOG_BATCH && end - tail < log_ring_size) {
+			log_record *r = log_record_at(end);
+			unsigned int state = __atomic_load_n(&r->state, __ATOMIC_ACQUIRE);
+			if (!(state & LOG_READY)) {
+				break;
+			}
+			if (!(state & LOG_PAD)) {
+				if (log_stamp) {
+					iov[count].iov_base = stamps[records];
+					iov[count++].iov_len = log_format_stamp(stamps[records], r->timestamp, r->pid);
+				}
+				iov[count].iov_base = r + 1;
+				iov[count++].iov_len = r->len;
+				records++;
+			}
+			end += state & LOG_SIZE_MASK;
+		}
+		if (end != tail) {
+			pthread_mutex_lock(&log_write_lock);
+			log_writev(iov, count);
+			pthread_mutex_unlock(&log_write_lock);
+			// the space may wrap around the end of the ring
+			unsigned long from = tail & (log_ring_size - 1);
+			unsigned long bytes = end - tail;
+			unsigned long first = min(bytes, log_ring_size - from);
+			memset(log_ring + from, 0, first);
+			memset(log_ring, 0, bytes - first);
+			tail = end;
+			pthread_mutex_lock(&log_lock);
+			log_tail.store(tail);
+			pthread_cond_broadcast(&log_space);
+			pthread_mutex_unlock(&log_lock);
+			continue;
+		}
+		pthread_mutex_lock(&log_lock);
+		log_flusher_idle.store(true);
+		if (!(__atomic_load_n(&log_record_at(tail)->state, __ATOMIC_SEQ_CST) & LOG_READY)) {
+			if (log_stopping.load()) {
+				pthread_mutex_unlock(&log_lock);
+				return 0;
+			}
+			// a producer that saw the flusher busy is caught by the timeout
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += 10000000;
+			if (ts.tv_nsec >= 1000000000) {
+				ts.tv_sec++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait(&log_wakeup, &log_lock, &ts);
+		}
+		log_flusher_idle.store(false);
+		pthread_mutex_unlock(&log_lock);
+	}
+}
+
+// size bytes of log_ring, 0 if the ring is full and messages are dropped
+// size is at most half the ring, so it fits past any padding once the flusher catches up
+log_record *
+log_reserve(unsigned long size)
+{
+	while (1) {
+		unsigned long head = log_head.load();
+		unsigned long room = log_ring_size - (head & (log_ring_size - 1));
+		unsigned long pad = room < size ? room : 0;
+		if (head + pad + size - log_tail.load() > log_ring_size) {
+			if (log_drop) {
+				return 0;
+			}
+			pthread_mutex_lock(&log_lock);
+			if (head + pad + size - log_tail.load() > log_ring_size) {
+				pthread_cond_wait(&log_space, &log_lock);
+			}
+			pthread_mutex_unlock(&log_lock);
+			continue;
+		}
+		if (log_head.compare_exchange_weak(head, head + pad + size)) {
+			if (pad) {
+				__atomic_store_n(&log_record_at(head)->state, pad | LOG_PAD | LOG_READY, __ATOMIC_RELEASE);
+			}
+			return log_record_at(head + pad);
+		}
+	}
+}
+
+void
+log_publish(log_record *r, unsigned long size)
+{
+	__atomic_store_n(&r->state, size | LOG_READY, __ATOMIC_SEQ_CST);
+	if (log_flusher_idle.load()) {
+		pthread_mutex_lock(&log_lock);
+		pthread_cond_signal(&log_wakeup);
+		pthread_mutex_unlock(&log_lock);
+	}
+}
+
+// wait until everything logged so far has been written
+void
+log_flush()
+{
+	if (!log_flusher_running) {
+		return;
+	}
+	pthread_mutex_lock(&log_lock);
+	while (log_tail.load() != log_head.load()) {
+		pthread_cond_signal(&log_wakeup);
+		pthread_cond_wait(&log_space, &log_lock);
+	}
+	pthread_mutex_unlock(&log_lock);
+}
+
+void
+log_shutdown()
+{
+	if (log_flusher_running) {
+		pthread_mutex_lock(&log_lock);
+		log_stopping.store(true);
+		pthread_cond_signal(&log_wakeup);
+		pthread_mutex_unlock(&log_lock);
+		pthread_join(log_flusher, 0);
+		log_flusher_running = false;
+	}
+	log_write_buffer();
+	if (getenv("VM_SYSLOG_STATS")) {
+		fprintf(stderr, "syslog records %lu bytes %lu dropped %lu dropped_bytes %lu\n",
+			log_stats.records.load(), log_stats.bytes.load(),
+			log_stats.dropped_records.load(), log_stats.dropped_bytes.load());
+	}
+}
+
+void
+log_init()
+{
+	const char *file = getenv("VM_SYSLOG_FILE");
+	if (file) {
+		int fd = open(file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+		if (fd >= 0) {
+			log_fd = fd;
+		}
+	}
+	const char *full = getenv("VM_SYSLOG_FULL");
+	log_drop = full && !strcmp(full, "drop");
+	log_stamp = getenv("VM_SYSLOG_STAMP") != 0;
+	const char *ring = getenv("VM_SYSLOG_RING");
+	unsigned long bytes = ring ? strtoul(ring, 0, 0) : 0;
+	log_ring_size = 0;
+	if (bytes) {
+		log_ring_size = 4096;
+		while (log_ring_size < bytes && log_ring_size < (LOG_SIZE_MASK + 1) / 2) {
+			log_ring_size *= 2;
+		}
+		log_ring = (char *)calloc(log_ring_size, 1);
+		log_flusher_running = pthread_create(&log_flusher, 0, log_flusher_main, 0) == 0;
+	}
+	atexit(log_shutdown);
+}
+
+/**********
+replacement policies
+
+vm_fault and vm_extend tell the policy about every resident page:
+	page_resident(frame): the page owning frame was just paged in
+	page_referenced(frame): a resident page faulted because its ref bit had been cleared
+	choose_victim(): pick a resident frame to evict and forget it
+	page_destroyed(frame): the owning process exited
+	eviction_order(frames, limit): up to limit frames in roughly the order they would be
+		evicted, without touching any state; the cleaner writes back from the front of it
+frame_table[frame].ref is set by vm_fault on every access it sees; a policy calls
+clear_ref() to sample it again later.  choose_victim only returns frames evictable() accepts
+(never a pinned one, see "working sets and quotas").  The access that pages a frame in also sets
+ref, so the scan-resistant policies remember fresh frames and do not count that
+first access as a reuse.
+
+VM_PAGER_POLICY picks one of: clock (default), clockpro, arc, lruk, 2q
+**********/
+class Replacement_policy{
+public:
+	virtual ~Replacement_policy() {}
+	virtual void page_resident(unsigned int frame) = 0;
+	virtual void page_referenced(unsigned int) {}
+	virtual unsigned int choose_victim() = 0;
+	virtual void page_destroyed(unsigned int frame) = 0;
+	virtual void eviction_order(vector<unsigned int> &frames, unsigned int limit) = 0;
+};
+
+// single hand second chance
+class Clock_policy : public Replacement_policy{
+	Frame_ring ring;
+	unsigned int clock_pointer;
+public:
+	Clock_policy(unsigned int memory_pages){
+		ring.init(memory_pages);
+		clock_pointer = ring.end();
+	}
+
+	void page_resident(unsigned int frame) {
+		ring.push_back(frame);
+	}
+
+	void page_destroyed(unsigned int frame){
+		if (frame == clock_pointer) {
+			clock_pointer = frame_table[clock_pointer].next;
+		}
+		ring.remove(frame);
+	}
+
+	unsigned int choose_victim(){
+		while (1){
+			
+			// skip dummy head and frames that may not go
+			if (clock_pointer == ring.end() || !evictable(clock_pointer)) {
+				clock_pointer = frame_table[clock_pointer].next;
+				continue;
+			}
+			
+			// lookup and set 0 ref bit
+			if (!frame_table[clock_pointer].ref) {
+				break;
+			}
+			clear_ref(clock_pointer);
+			clock_pointer = frame_table[clock_pointer].next;
+		}
+
+		// remove victim out of the queue
+		unsigned int victim = clock_pointer;
+		clock_pointer = frame_table[clock_pointer].next;
+		ring.remove(victim);
+		return victim;
+	}
+
+	void eviction_order(vector<unsigned int> &frames, unsigned int limit) {
+		unsigned int frame = clock_pointer;
+		for (unsigned int i = 0; i <= ring.size() && frames.size() < limit; i++) {
+			if (frame != ring.end()) {
+				frames.push_back(frame);
+			}
+			frame = frame_table[frame].next;
+		}
+	}
+};
+
+/**********
+Car_policy: ARC approximated with clocks (Bansal & Modha, CAR)
+	t1: recency clock, pages seen once
+	t2: frequency clock, pages reused since they came in
+	b1, b2: ghosts of pages evicted from t1 and t2
+	p: adaptive target size of t1, grows on b1 hits and shrinks on b2 hits
+**********/
+class Car_policy : public Replacement_policy{
+	unsigned int c;
+	unsigned int p;
+	Frame_ring t1, t2;
+	Ghost_list b1, b2;
+	vector<unsigned char> in_t2;
+	vector<unsigned char> fresh;
+public:
+	Car_policy(unsigned int memory_pages) : c(memory_pages), p(0), in_t2(memory_pages), fresh(memory_pages) {
+		t1.init(memory_pages);
+		t2.init(memory_pages + 1);
+	}
+
+	void page_resident(unsigned int frame) {
+		unsigned long long key = frame_key(frame);
+		fresh[frame] = 1;
+		if (b1.contains(key)) {
+			p = min(p + max(1u, b2.size() / b1.size()), c);
+			b1.erase(key);
+			in_t2[frame] = 1;
+			t2.push_back(frame);
+		} else if (b2.contains(key)) {
+			unsigned int delta = max(1u, b1.size() / b2.size());
+			p = p > delta ? p - delta : 0;
+			b2.erase(key);
+			in_t2[frame] = 1;
+			t2.push_back(frame);
+		} else {
+			// directory replacement, keep |t1| + |b1| <= c and the whole directory <= 2c
+			if (t1.size() + b1.size() >= c && b1.size()) {
+				b1.pop_front();
+			} else if (t1.size() + t2.size() + b1.size() + b2.size() >= 2 * c && b2.size()) {
+				b2.pop_front();
+			}
+			in_t2[frame] = 0;
+			t1.push_back(frame);
+		}
+	}
+
+	void page_destroyed(unsigned int frame) {
+		(in_t2[frame] ? t2 : t1).remove(frame);
+	}
+
+	unsigned int choose_victim() {
+		// frames that may not go are rotated to the back; after a whole list of them try the other list
+		// and after both start over, evictable() lets quota-protected frames through in the end
+		unsigned int pinned_t1 = 0, pinned_t2 = 0;
+		while (1) {
+			if (pinned_t1 >= t1.size() && pinned_t2 >= t2.size()) {
+				pinned_t1 = pinned_t2 = 0;
+			}
+			bool from_t1 = !t1.empty() && (t1.size() >= max(1u, p) || t2.empty());
+			if ((from_t1 ? pinned_t1 >= t1.size() : pinned_t2 >= t2.size()) && !(from_t1 ? t2 : t1).empty()) {
+				from_t1 = !from_t1;
+			}
+			if (from_t1) {
+				unsigned int frame = t1.front();
+				t1.remove(frame);
+				if (!evictable(frame)) {
+					pinned_t1++;
+					t1.push_back(frame);
+					continue;
+				}
+				if (!frame_table[frame].ref) {
+					b1.push_back(frame_key(frame));
+					return frame;
+				}
+				clear_ref(frame);
+				if (fresh[frame]) {
+					// the access that paged it in, give it another lap in t1
+					fresh[frame] = 0;
+					t1.push_back(frame);
+				} else {
+					in_t2[frame] = 1;
+					t2.push_back(frame);
+				}
+			} else {
+				unsigned int frame = t2.front();
+				t2.remove(frame);
+				if (!evictable(frame)) {
+					pinned_t2++;
+					t2.push_back(frame);
+					continue;
+				}
+				if (!frame_table[frame].ref) {
+					b2.push_back(frame_key(frame));
+					return frame;
+				}
+				clear_ref(frame);
+				t2.push_back(frame);
+			}
+		}
+	}
+
+	void eviction_order(vector<unsigned int> &frames, unsigned int limit) {
+		Frame_ring *first = t1.size() >= max(1u, p) ? &t1 : &t2;
+		Frame_ring *second = first == &t1 ? &t2 : &t1;
+		for (unsigned int f = first->front(); f != first->end() && frames.size() < limit; f = frame_table[f].next) {
+			frames.push_back(f);
+		}
+		for (unsigned int f = second->front(); f != second->end() && frames.size() < limit; f = frame_table[f].next) {
+			frames.push_back(f);
+		}
+	}
+};
+
+/**********
+Clock_pro_policy (Jiang, Chen & Zhang, CLOCK-Pro)
+	one clock holding hot pages, cold resident pages and cold non-resident pages in their test period
+	hand_cold: finds victims among cold resident pages, promotes cold pages reused during their test
+	hand_hot: demotes unreferenced hot pages, ends test periods and drops expired non-resident entries
+	cold_target: adaptive number of resident cold pages, grows when a non-resident cold page is
+		faulted in during its test and shrinks when a test expires
+**********/
+class Clock_pro_policy : public Replacement_policy{
+	struct entry{
+		unsigned long long key;
+		unsigned int frame;		// NO_FRAME once evicted
+		unsigned char hot;
+		unsigned char test;
+		unsigned char fresh;
+	};
+	static const unsigned int NO_FRAME = (unsigned int)-1;
+	list<entry> clock;
+	list<entry>::iterator hand_cold, hand_hot;
+	vector<list<entry>::iterator> position;
+	unordered_map<unsigned long long, list<entry>::iterator> non_resident;
+	unsigned int m, cold_target, hot_count, cold_count;
+
+	void advance(list<entry>::iterator &hand) {
+		if (hand == clock.end() || ++hand == clock.end()) {
+			hand = clock.begin();
+		}
+	}
+	// erase an entry without invalidating the hands
+	void erase(list<entry>::iterator it) {
+		if (hand_cold == it) {
+			advance(hand_cold);
+		}
+		if (hand_hot == it) {
+			advance(hand_hot);
+		}
+		if (hand_cold == it) {
+			hand_cold = clock.end();
+		}
+		if (hand_hot == it) {
+			hand_hot = clock.end();
+		}
+		clock.erase(it);
+	}
+	// move an entry to the head of the clock, just behind both hands
+	void move_to_head(list<entry>::iterator it) {
+		entry e = *it;
+		erase(it);
+		insert_at_head(e);
+	}
+	void insert_at_head(entry e) {
+		list<entry>::iterator pos = hand_hot == clock.end() ? clock.end() : hand_hot;
+		list<entry>::iterator it = clock.insert(pos, e);
+		if (e.frame != NO_FRAME) {
+			position[e.frame] = it;
+		} else {
+			non_resident[e.key] = it;
+		}
+		if (hand_cold == clock.end()) {
+			hand_cold = it;
+		}
+		if (hand_hot == clock.end()) {
+			hand_hot = it;
+		}
+	}
+	void drop_non_resident(list<entry>::iterator it) {
+		non_resident.erase(it->key);
+		erase(it);
+	}
+	void run_hand_hot() {
+		unsigned int steps = clock.size() * 2 + 1;
+		while (steps-- && hand_hot != clock.end()) {
+			list<entry>::iterator it = hand_hot;
+			advance(hand_hot);
+			if (it->frame == NO_FRAME) {
+				// its test period ends, it was not reused in time
+				drop_non_resident(it);
+				if (cold_target > 1) {
+					cold_target--;
+				}
+				continue;
+			}
+			if (it->hot) {
+				if (frame_table[it->frame].ref) {
+					clear_ref(it->frame);
+				} else {
+					it->hot = 0;
+					it->test = 0;
+					hot_count--;
+					cold_count++;
+					// one more cold page to look at, see evictable
+					quota_refused = 0;
+					return;
+				}
+			} else {
+				it->test = 0;
+			}
+		}
+	}
+	void balance() {
+		while (hot_count > 0 && hot_count > m - min(cold_target, m - 1)) {
+			unsigned int before = hot_count;
+			run_hand_hot();
+			if (hot_count == before) {
+				break;
+			}
+		}
+		while (non_resident.size() > m) {
+			list<entry>::iterator it = hand_hot;
+			while (it->frame != NO_FRAME) {
+				advance(it);
+			}
+			drop_non_resident(it);
+		}
+	}
+public:
+	Clock_pro_policy(unsigned int memory_pages) : position(memory_pages), m(memory_pages), cold_target(1), hot_count(0), cold_count(0) {
+		hand_cold = clock.end();
+		hand_hot = clock.end();
+	}
+
+	void page_resident(unsigned int frame) {
+		unsigned long long key = frame_key(frame);
+		entry e = {key, frame, 0, 1, 1};
+		unordered_map<unsigned long long, list<entry>::iterator>::iterator it = non_resident.find(key);
+		if (it != non_resident.end()) {
+			// reused during its test period, it deserves to be hot
+			drop_non_resident(it->second);
+			cold_target = min(cold_target + 1, m);
+			e.hot = 1;
+			e.test = 0;
+			hot_count++;
+		} else {
+			cold_count++;
+		}
+		insert_at_head(e);
+		balance();
+	}
+
+	void page_destroyed(unsigned int frame) {
+		if (position[frame]->hot) {
+			hot_count--;
+		} else {
+			cold_count--;
+		}
+		erase(position[frame]);
+	}
+
+	unsigned int choose_victim() {
+		if (cold_count == 0) {
+			// everything is hot, demote until a cold page shows up
+			while (cold_count == 0) {
+				run_hand_hot();
+			}
+		}
+		unsigned int steps = 0;
+		while (1) {
+			if (++steps > clock.size()) {
+				// only pinned or quota-protected cold pages left, demote another hot page
+				run_hand_hot();
+				steps = 0;
+			}
+			list<entry>::iterator it = hand_cold;
+			advance(hand_cold);
+			if (it->frame == NO_FRAME || it->hot || !evictable(it->frame)) {
+				continue;
+			}
+			unsigned int frame = it->frame;
+			if (frame_table[frame].ref) {
+				clear_ref(frame);
+				if (it->fresh) {
+					it->fresh = 0;
+				} else if (it->test) {
+					it->hot = 1;
+					cold_count--;
+					hot_count++;
+					move_to_head(it);
+					balance();
+					if (cold_count == 0) {
+						while (cold_count == 0) {
+							run_hand_hot();
+						}
+					}
+				} else {
+					it->test = 1;
+					move_to_head(it);
+				}
+				continue;
+			}
+			cold_count--;
+			if (it->test) {
+				it->frame = NO_FRAME;
+				non_resident[it->key] = it;
+			} else {
+				erase(it);
+			}
+			balance();
+			return frame;
+		}
+	}
+
+	void eviction_order(vector<unsigned int> &frames, unsigned int limit) {
+		list<entry>::iterator it = hand_cold;
+		for (unsigned int i = 0; i < clock.size() && frames.size() < limit; i++) {
+			if (it->frame != NO_FRAME && !it->hot) {
+				frames.push_back(it->frame);
+			}
+			advance(it);
+		}
+	}
+};
+
+/**********
+Lru_k_policy: LRU-2 (O'Neil, O'Neil & Weikum)
+	evicts the page whose second most recent reference is oldest, pages seen once go first
+	references are observed from faults and from ref bits found set by choose_victim
+	history of evicted pages is kept for memory_pages pages
+**********/
+class Lru_k_policy : public Replacement_policy{
+	typedef struct {
+		unsigned long long last;
+		unsigned long long second;
+	} history;
+	// (second, last), frame
+	typedef pair<pair<unsigned long long, unsigned long long>, unsigned int> rank;
+	set<rank> order;
+	vector<history> hist;
+	// 1: ref bit is from the access that paged it in, 2: ref bit already recorded by page_referenced
+	vector<unsigned char> fresh;
+	Ghost_list retained;
+	unordered_map<unsigned long long, history> retained_hist;
+	unsigned int m;
+	unsigned long long tick;
+
+	rank rank_of(unsigned int frame) {
+		return rank(make_pair(hist[frame].second, hist[frame].last), frame);
+	}
+	void reference(unsigned int frame) {
+		order.erase(rank_of(frame));
+		hist[frame].second = hist[frame].last;
+		hist[frame].last = ++tick;
+		order.insert(rank_of(frame));
+	}
+public:
+	Lru_k_policy(unsigned int memory_pages) : hist(memory_pages), fresh(memory_pages), m(memory_pages), tick(0) {}
+
+	void page_resident(unsigned int frame) {
+		unsigned long long key = frame_key(frame);
+		unordered_map<unsigned long long, history>::iterator it = retained_hist.find(key);
+		if (it != retained_hist.end()) {
+			hist[frame] = it->second;
+			retained_hist.erase(it);
+			retained.erase(key);
+		} else {
+			hist[frame].last = 0;
+			hist[frame].second = 0;
+		}
+		fresh[frame] = 1;
+		order.insert(rank_of(frame));
+		reference(frame);
+	}
+
+	void page_referenced(unsigned int frame) {
+		reference(frame);
+		fresh[frame] = 2;
+	}
+
+	void page_destroyed(unsigned int frame) {
+		order.erase(rank_of(frame));
+	}
+
+	unsigned int choose_victim() {
+		while (1) {
+			set<rank>::iterator it = order.begin();
+			while (!evictable(it->second)) {
+				if (++it == order.end()) {
+					it = order.begin();
+				}
+			}
+			unsigned int frame = it->second;
+			if (!frame_table[frame].ref) {
+				order.erase(it);
+				if (retained.size() >= m) {
+					retained_hist.erase(retained.pop_front());
+				}
+				unsigned long long key = frame_key(frame);
+				retained.push_back(key);
+				retained_hist[key] = hist[frame];
+				return frame;
+			}
+			clear_ref(frame);
+			if (fresh[frame] == 1) {
+				// the access that paged it in was already counted, watch it once more
+				order.erase(it);
+				hist[frame].last = ++tick;
+				order.insert(rank_of(frame));
+			} else if (!fresh[frame]) {
+				reference(frame);
+			}
+			fresh[frame] = 0;
+		}
+	}
+
+	void eviction_order(vector<unsigned int> &frames, unsigned int limit) {
+		for (set<rank>::iterator it = order.begin(); it != order.end() && frames.size() < limit; ++it) {
+			frames.push_back(it->second);
+		}
+	}
+};
+
+/**********
+Two_q_policy: full 2Q (Johnson & Shasha)
+	a1in: FIFO of pages seen once, about a quarter of memory
+	a1out: ghosts of pages pushed out of a1in, about half of memory
+	am: clock of pages faulted again while remembered in a1out
+**********/
+class Two_q_policy : public Replacement_policy{
+	Frame_ring a1in, am;
+	Ghost_list a1out;
+	unsigned int am_pointer;
+	unsigned int kin, kout;
+	vector<unsigned char> in_am;
+public:
+	Two_q_policy(unsigned int memory_pages) : in_am(memory_pages) {
+		a1in.init(memory_pages);
+		am.init(memory_pages + 1);
+		am_pointer = am.end();
+		kin = max(1u, memory_pages / 4);
+		kout = max(1u, memory_pages / 2);
+	}
+
+	void page_resident(unsigned int frame) {
+		if (a1out.erase(frame_key(frame))) {
+			in_am[frame] = 1;
+			am.push_back(frame);
+		} else {
+			in_am[frame] = 0;
+			a1in.push_back(frame);
+		}
+	}
+
+	void page_destroyed(unsigned int frame) {
+		if (!in_am[frame]) {
+			a1in.remove(frame);
+			return;
+		}
+		if (frame == am_pointer) {
+			am_pointer = frame_table[am_pointer].next;
+		}
+		am.remove(frame);
+	}
+
+	// the oldest evictable frame of a1in, remembered in a1out; a1in.end() if there is none
+	unsigned int evict_a1in() {
+		for (unsigned int frame = a1in.front(); frame != a1in.end(); frame = frame_table[frame].next) {
+			if (!evictable(frame)) {
+				continue;
+			}
+			a1in.remove(frame);
+			if (a1out.size() >= kout) {
+				a1out.pop_front();
+			}
+			a1out.push_back(frame_key(frame));
+			return frame;
+		}
+		return a1in.end();
+	}
+
+	unsigned int choose_victim() {
+		if (!a1in.empty() && (a1in.size() > kin || am.empty())) {
+			unsigned int frame = evict_a1in();
+			// with am empty try again until evictable() lets quota-protected frames through
+			while (frame == a1in.end() && am.empty()) {
+				frame = evict_a1in();
+			}
+			if (frame != a1in.end()) {
+				return frame;
+			}
+		}
+		unsigned int pinned = 0;
+		while (1) {
+			if (am_pointer == am.end()) {
+				am_pointer = frame_table[am_pointer].next;
+				continue;
+			}
+			if (!evictable(am_pointer)) {
+				if (++pinned > am.size()) {
+					// no frame of am may go
+					unsigned int frame = evict_a1in();
+					if (frame != a1in.end()) {
+						return frame;
+					}
+					pinned = 0;
+				}
+				am_pointer = frame_table[am_pointer].next;
+				continue;
+			}
+			pinned = 0;
+			if (!frame_table[am_pointer].ref) {
+				break;
+			}
+			clear_ref(am_pointer);
+			am_pointer = frame_table[am_pointer].next;
+		}
+		unsigned int victim = am_pointer;
+		am_pointer = frame_table[am_pointer].next;
+		am.remove(victim);
+		return victim;
+	}
+
+	void eviction_order(vector<unsigned int> &frames, unsigned int limit) {
+		if (a1in.size() > kin || am.empty()) {
+			for (unsigned int f = a1in.front(); f != a1in.end() && frames.size() < limit; f = frame_table[f].next) {
+				frames.push_back(f);
+			}
+		}
+		unsigned int frame = am_pointer;
+		for (unsigned int i = 0; i <= am.size() && frames.size() < limit; i++) {
+			if (frame != am.end()) {
+				frames.push_back(frame);
+			}
+			frame = frame_table[frame].next;
+		}
+	}
+};
+
+Replacement_policy *replacement_policy;
+
+Replacement_policy *new_replacement_policy(const char *name, unsigned int memory_pages) {
+	if (name && !strcmp(name, "clockpro")) {
+		return new Clock_pro_policy(memory_pages);
+	}
+	if (name && !strcmp(name, "arc")) {
+		return new Car_policy(memory_pages);
+	}
+	if (name && !strcmp(name, "lruk")) {
+		return new Lru_k_policy(memory_pages);
+	}
+	if (name && !strcmp(name, "2q")) {
+		return new Two_q_policy(memory_pages);
+	}
+	return new Clock_policy(memory_pages);
+}
+
+/**********
+Swap_allocator: disk blocks, handed out so that consecutive pages of a process land on consecutive blocks
+	the disk is cut into runs of run_size blocks; as a process extends, it claims an entirely
+	free run for every run_size pages of its arena, and page vpn of that stretch gets block
+	run * run_size + vpn % run_size whenever it needs one, so read-ahead and the cleaner's
+	sorted batches become sequential disk I/O
+	claims are soft: once no unclaimed block is left a page takes any free block, and
+	vm_destroy gives the runs back
+	a block merged pages were written to is held by each of them: share() adds a holder and
+	free() drops one, the block is free once none is left
+**********/
+class Swap_allocator{
+	vector<unsigned long long> free_bits;	// 1 = free
+	vector<int> run_owner;			// slot, -1 if unclaimed
+	vector<unsigned int> run_free;		// free blocks in each run
+	vector<unsigned int> claimable;		// unclaimed runs that were entirely free when queued
+	vector<unsigned char> queued;
+	vector<unsigned int> holders;
+	vector<unsigned char> in_flight;	// WRITE_*, see "concurrency"
+	unsigned int blocks, runs, free_count, cursor;
+
+	enum { WRITE_NONE, WRITE_RUNNING, WRITE_FREED };
+
+	bool is_free(unsigned int block) {
+		return (free_bits[block / 64] >> (block % 64)) & 1;
+	}
+	unsigned int run_length(unsigned int run) {
+		return min(run_size, blocks - run * run_size);
+	}
+	void take(unsigned int block) {
+		holders[block] = 1;
+		free_bits[block / 64] &= ~(1ULL << (block % 64));
+		free_count--;
+		run_free[block / run_size]--;
+	}
+	// the last holder let go of block: back on the free bits, its run is queued by the caller
+	void put_back(unsigned long block) {
+		pool_drop(block);
+		free_bits[block / 64] |= 1ULL << (block % 64);
+		free_count++;
+		run_free[block / run_size]++;
+	}
+	void queue_if_claimable(unsigned int run) {
+		if (run_owner[run] < 0 && run_free[run] == run_length(run) && !queued[run]) {
+			queued[run] = 1;
+			claimable.push_back(run);
+		}
+	}
+	// first free block of run at or after goal, wrapping inside the run
+	unsigned int find_in_run(unsigned int run, unsigned int goal) {
+		unsigned int start = run * run_size, length = run_length(run);
+		for (unsigned int i = 0; i < length; i++) {
+			unsigned int block = start + (goal - start + i) % length;
+			if (is_free(block)) {
+				return block;
+			}
+		}
+		return (unsigned int)-1;
+	}
+public:
+	unsigned int run_size;
+
+	void init(unsigned int disk_blocks) {
+		blocks = disk_blocks;
+		// at least 16 runs, at most 32 blocks each
+		run_size = 32;
+		while (run_size > 1 && blocks / run_size < 16) {
+			run_size /= 2;
+		}
+		runs = (blocks + run_size - 1) / run_size;
+		free_bits.assign((blocks + 63) / 64, 0);
+		for (unsigned int b = 0; b < blocks; b++) {
+			free_bits[b / 64] |= 1ULL << (b % 64);
+		}
+		run_owner.assign(runs, -1);
+		run_free.resize(runs);
+		holders.assign(blocks, 0);
+		in_flight.assign(blocks, WRITE_NONE);
+		queued.assign(runs, 0);
+		// claim from the start of the disk first
+		for (unsigned int r = runs; r-- > 0; ) {
+			run_free[r] = run_length(r);
+			queue_if_claimable(r);
+		}
+		free_count = blocks;
+		cursor = 0;
+	}
+
+	bool empty() {
+		return free_count == 0;
+	}
+
+	// claim a run for the stretch of info's arena holding page_num, if it has none yet
+	void reserve(proc_vm_info *info, int slot, unsigned int page_num) {
+		unsigned int stretch = page_num / run_size;
+		if (stretch >= info->swap_runs.size()) {
+			info->swap_runs.resize(stretch + 1, -1);
+		}
+		if (info->swap_runs[stretch] >= 0 && run_owner[info->swap_runs[stretch]] == slot) {
+			return;
+		}
+		info->swap_runs[stretch] = -1;
+		while (!claimable.empty()) {
+			unsigned int run = claimable.back();
+			claimable.pop_back();
+			queued[run] = 0;
+			if (run_owner[run] < 0 && run_free[run] == run_length(run)) {
+				run_owner[run] = slot;
+				info->swap_runs[stretch] = run;
+				return;
+			}
+		}
+	}
+
+	// caller makes sure the disk is not full
+	unsigned long alloc(proc_vm_info *info, int slot, unsigned int page_num) {
+		reserve(info, slot, page_num);
+		int run = info->swap_runs[page_num / run_size];
+		if (run >= 0) {
+			unsigned int block = find_in_run(run, run * run_size + page_num % run_size);
+			if (block != (unsigned int)-1) {
+				take(block);
+				return block;
+			}
+		}
+		// unclaimed runs first, then anyone's
+		for (int pass = 0; pass < 2; pass++) {
+			for (unsigned int i = 0; i < runs; i++) {
+				unsigned int r = (cursor + i) % runs;
+				if (run_free[r] && (pass || run_owner[r] < 0)) {
+					unsigned int block = find_in_run(r, r * run_size);
+					cursor = r;
+					take(block);
+					return block;
+				}
+			}
+		}
+		return NO_DISK_BLOCK;
+	}
+
+	void share(unsigned long block) {
+		holders[block]++;
+	}
+
+	// a block being written without pager_lock is freed once the write is done
+	void free(unsigned long block) {
+		if (--holders[block]) {
+			return;
+		}
+		if (in_flight[block]) {
+			in_flight[block] = WRITE_FREED;
+			return;
+		}
+		put_back(block);
+		queue_if_claimable(block / run_size);
+	}
+
+	// free a whole batch, each run is checked once at the end
+	void free_all(const vector<unsigned long> &blocks) {
+		for (unsigned int i = 0; i < blocks.size(); i++) {
+			unsigned long block = blocks[i];
+			if (--holders[block]) {
+				continue;
+			}
+			if (in_flight[block]) {
+				in_flight[block] = WRITE_FREED;
+				continue;
+			}
+			put_back(block);
+		}
+		for (unsigned int i = 0; i < blocks.size(); i++) {
+			queue_if_claimable(blocks[i] / run_size);
+		}
+	}
+
+	bool writing(unsigned long block) {
+		return block != NO_DISK_BLOCK && in_flight[block];
+	}
+	void start_write(unsigned long block) {
+		in_flight[block] = WRITE_RUNNING;
+	}
+	void end_write(unsigned long block) {
+		bool freed = in_flight[block] == WRITE_FREED;
+		in_flight[block] = WRITE_NONE;
+		if (freed) {
+			put_back(block);
+			queue_if_claimable(block / run_size);
+		}
+	}
+
+	// give up the runs of the stretches from "from" on
+	void release(proc_vm_info *info, int slot, unsigned int from = 0) {
+		for (unsigned int i = from; i < info->swap_runs.size(); i++) {
+			int run = info->swap_runs[i];
+			if (run >= 0 && run_owner[run] == slot) {
+				run_owner[run] = -1;
+				queue_if_claimable(run);
+			}
+		}
+		if (from < info->swap_runs.size()) {
+			info->swap_runs.resize(from);
+		}
+	}
+};
+
+Swap_allocator swap_space;
+
+// write the victim in frame to block, or with write_back leave a disk write to the caller:
+// the block is marked in flight and *write_back set to it, and the caller runs
+// disk_write_timed and then write_finished once the frame is pinned (see fault_page)
+// a store into the pool is done here, it needs pager_lock
+void
+write_victim(unsigned long block, unsigned int frame, unsigned long *write_back)
+{
+	if (!write_back) {
+		write_block(block, frame);
+		return;
+	}
+	if (pool_size && pool_put(block, frame)) {
+		return;
+	}
+	swap_space.start_write(block);
+	*write_back = block;
+}
+
+void
+write_finished(unsigned long block)
+{
+	swap_space.end_write(block);
+	pthread_cond_broadcast(&write_done);
+}
+
+// give a free frame to a page and tell the replacement policy
+void frame_resident(unsigned int frame, virtual_page_indentifier vpi) {
+	frame_info *fi = &frame_table[frame];
+	fi->slot = vpi.slot;
+	fi->page_num = vpi.page_num;
+	fi->ref = 0;
+	fi->dirt = 0;
+	fi->pinned = 0;
+	fi->prefetched = 0;
+	fi->in_use = 1;
+	fi->shared = 0;
+	vm_info.at(vpi.slot)->resident_frames++;
+	replacement_policy->page_resident(frame);
+}
+
+unordered_map<unsigned long long, unsigned long> temp_disk_block_map;
+
+// block holds an unmodified copy of the resident page
+void
+set_temp(proc_vm_info *info, unsigned int page_num, unsigned long block)
+{
+	info->extra_info[page_num].temped = 1;
+	info->extra_info[page_num].disk_num = block;
+	temp_disk_block_map[page_key(info->pid, page_num)] = block;
+}
+
+// the page is paged out: its temp block becomes its disk block
+void
+take_temp(proc_vm_info *info, unsigned int page_num)
+{
+	info->extra_info[page_num].temped = 0;
+	temp_disk_block_map.erase(page_key(info->pid, page_num));
+}
+
+// drop the temp block of a page, if it has one
+void
+drop_temp(proc_vm_info *info, unsigned int page_num)
+{
+	if (info->extra_info[page_num].temped) {
+		swap_space.free(info->extra_info[page_num].disk_num);
+		take_temp(info, page_num);
+	}
+}
+
+// one block must stay free or temped so a dirty victim can always be paged out (see overcommit)
+unsigned long valid_page_limit;
+unsigned long valid_pages;
+unsigned int overcommit_percent;
+// pages that are not zero pages, each one's contents need a frame or a block (see overcommit)
+unsigned long data_page_limit;
+unsigned long data_pages;
+
+// a block for page_num, dropping temp blocks while the disk is full
+unsigned long
+alloc_swap_block(proc_vm_info *info, int slot, unsigned int page_num)
+{
+	while (swap_space.empty() && !temp_disk_block_map.empty()) {
+		unsigned long long key = temp_disk_block_map.begin()->first;
+		proc_vm_info *owner = vm_info.at(vm_info.slot((pid_t)(key >> 32)));
+		drop_temp(owner, (unsigned int)key);
+	}
+	return swap_space.alloc(info, slot, page_num);
+}
+
+/**********
+cleaner: background write-back, run from vm_switch while no process is waiting on a fault
+	walks the frames the policy would evict next, and when fewer than cleaner_reserve of them
+	are free or clean, writes back the dirty unreferenced ones (at most cleaner_batch per pass)
+	in block order; the written block stays with the page as its temp block, so evicting it
+	later only drops the temp entry and the fault pays a single disk_read
+
+	an unreferenced page has read and write disabled already, so its next write still faults
+	and gives the temp block back
+
+	VM_CLEANER_RESERVE (default memory_pages / 16, 0 disables) and VM_CLEANER_BATCH (default 32)
+**********/
+unsigned int cleaner_reserve;
+unsigned int cleaner_batch;
+vector<unsigned int> cleaner_frames;
+vector<pair<unsigned long, unsigned int> > cleaner_writes;
+
+bool page_is_clean(proc_vm_info *info, unsigned int page_num) {
+	return info->extra_info[page_num].zero || info->extra_info[page_num].temped;
+}
+
+void run_cleaner() {
+	if (!cleaner_reserve || free_phy_mem_page_list.size() >= cleaner_reserve) {
+		return;
+	}
+	unsigned int clean = free_phy_mem_page_list.size();
+	cleaner_frames.clear();
+	cleaner_writes.clear();
+	replacement_policy->eviction_order(cleaner_frames, 2 * cleaner_reserve);
+	for (unsigned int i = 0; i < cleaner_frames.size() && clean < cleaner_reserve; i++) {
+		unsigned int frame = cleaner_frames[i];
+		frame_info *fi = &frame_table[frame];
+		if (fi->ref || fi->shared) {
+			continue;
+		}
+		proc_vm_info *info = vm_info.at(fi->slot);
+		if (page_is_clean(info, fi->page_num)) {
+			clean++;
+			continue;
+		}
+		if (cleaner_writes.size() >= cleaner_batch || swap_space.empty()) {
+			break;
+		}
+		cleaner_writes.push_back(make_pair(swap_space.alloc(info, fi->slot, fi->page_num), frame));
+		clean++;
+	}
+	sort(cleaner_writes.begin(), cleaner_writes.end());
+	for (unsigned int i = 0; i < cleaner_writes.size(); i++) {
+		unsigned long block = cleaner_writes[i].first;
+		frame_info *fi = &frame_table[cleaner_writes[i].second];
+		proc_vm_info *info = vm_info.at(fi->slot);
+		write_block(block, cleaner_writes[i].second);
+		stat_count(STAT_CLEANER_WRITE, info);
+		fi->dirt = 0;
+		set_temp(info, fi->page_num, block);
+	}
+}
+
+
+
+/**********
+page merging: an opt-in scanner run from vm_switch that folds resident pages with equal
+contents into one read-only shared frame
+	each pass hashes the next ksm_batch frames; a page whose hash did not change since the
+	previous pass is stable and is looked up in
+		ksm_stable: hash -> shared frame
+		ksm_unstable: hash -> a private frame seen earlier in this round of the frames
+	and merged after a memcmp confirms the match; an all-zero page becomes a zero page again
+	a shared frame sits once in the replacement policy; its pages keep write disabled, and a
+	write fault copies the frame into a private one (copy-on-write). evicting it writes it
+	once and every page keeps a holder of the block
+
+	VM_KSM sets the frames hashed per vm_switch (default 0, disabled);
+	VM_KSM_STATS=1 prints scanned/merged/zeroed/cow to stderr at exit
+**********/
+unsigned int ksm_batch;
+unsigned int ksm_cursor;
+unsigned long long zero_hash;
+vector<unsigned long long> ksm_hash;
+unordered_map<unsigned long long, unsigned int> ksm_stable;
+unordered_map<unsigned long long, unsigned int> ksm_unstable;
+
+struct {
+	unsigned long scanned;
+	unsigned long merged;
+	unsigned long zeroed;
+	unsigned long cow;
+} ksm_stats;
+
+void
+print_ksm_stats()
+{
+	fprintf(stderr, "ksm scanned %lu merged %lu zeroed %lu cow %lu\n",
+		ksm_stats.scanned, ksm_stats.merged, ksm_stats.zeroed, ksm_stats.cow);
+}
+
+char *frame_addr(unsigned int frame) {
+	return (char*)pm_physmem + (unsigned long)frame * VM_PAGESIZE;
+}
+
+unsigned long long
+page_hash(const char *page)
+{
+	const unsigned long long *word = (const unsigned long long *)page;
+	unsigned long long hash = 1469598103934665603ULL;
+	for (unsigned int i = 0; i < VM_PAGESIZE / sizeof(unsigned long long); i++) {
+		hash = (hash ^ word[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+void
+ksm_forget(unsigned int frame)
+{
+	unordered_map<unsigned long long, unsigned int>::iterator it = ksm_stable.find(ksm_hash[frame]);
+	if (it != ksm_stable.end() && it->second == frame) {
+		ksm_stable.erase(it);
+	}
+}
+
+// a page stops mapping a shared frame; the frame turns private again when one page is left
+void
+drop_sharer(unsigned int frame, virtual_page_indentifier vpi)
+{
+	frame_info *fi = &frame_table[frame];
+	vector<virtual_page_indentifier> &pages = frame_sharers[frame];
+	for (unsigned int i = 0; i < pages.size(); i++) {
+		if (pages[i].slot == vpi.slot && pages[i].page_num == vpi.page_num) {
+			pages.erase(pages.begin() + i);
+			break;
+		}
+	}
+	if (fi->slot != pages[0].slot) {
+		vm_info.at(fi->slot)->resident_frames--;
+		vm_info.at(pages[0].slot)->resident_frames++;
+	}
+	fi->slot = pages[0].slot;
+	fi->page_num = pages[0].page_num;
+	if (pages.size() == 1) {
+		fi->shared = 0;
+		ksm_forget(frame);
+		frame_sharers.erase(frame);
+	}
+}
+
+// page every page of a shared victim out; pages with a temp block keep it, the rest share one write
+void
+evict_shared(unsigned int frame, unsigned long *write_back)
+{
+	frame_info *fi = &frame_table[frame];
+	vector<virtual_page_indentifier> &pages = frame_sharers[frame];
+	bool written = true;
+	for (unsigned int i = 0; i < pages.size(); i++) {
+		if (!vm_info.at(pages[i].slot)->extra_info[pages[i].page_num].temped) {
+			written = false;
+		}
+	}
+	unsigned long block = NO_DISK_BLOCK;
+	if (!written) {
+		block = alloc_swap_block(vm_info.at(fi->slot), fi->slot, fi->page_num);
+		write_victim(block, frame, write_back);
+	}
+	bool block_used = false;
+	for (unsigned int i = 0; i < pages.size(); i++) {
+		proc_vm_info *info = vm_info.at(pages[i].slot);
+		page_extra_info *ei = &info->extra_info[pages[i].page_num];
+		ei->res = 0;
+		revoke_pte(info, pages[i].page_num);
+		if (ei->temped) {
+			take_temp(info, pages[i].page_num);
+		} else {
+			ei->disk_num = block;
+			if (block_used) {
+				swap_space.share(block);
+			}
+			block_used = true;
+		}
+	}
+	ksm_forget(frame);
+	frame_sharers.erase(frame);
+	fi->shared = 0;
+	vm_info.at(fi->slot)->resident_frames--;
+}
+
+// give a private frame back to the free list
+void
+release_frame(unsigned int frame)
+{
+	replacement_policy->page_destroyed(frame);
+	vm_info.at(frame_table[frame].slot)->resident_frames--;
+	frame_table[frame].in_use = 0;
+	free_phy_mem_page_list.push_back(frame);
+}
+
+// the page in frame is all zero: turn it back into a zero page
+void
+ksm_zero(unsigned int frame)
+{
+	frame_info *fi = &frame_table[frame];
+	proc_vm_info *info = vm_info.at(fi->slot);
+	page_extra_info *ei = &info->extra_info[fi->page_num];
+	drop_temp(info, fi->page_num);
+	ei->res = 0;
+	ei->zero = 1;
+	ei->disk_num = NO_DISK_BLOCK;
+	data_pages--;
+	revoke_pte(info, fi->page_num);
+	release_frame(frame);
+	ksm_stats.zeroed++;
+}
+
+// turn a private frame into a shared one whose only page is its owner
+void
+make_shared(unsigned int frame)
+{
+	frame_info *fi = &frame_table[frame];
+	virtual_page_indentifier owner = {fi->slot, (int)fi->page_num};
+	fi->shared = 1;
+	frame_sharers[frame].assign(1, owner);
+	revoke_pte(vm_info.at(fi->slot), fi->page_num, true);
+}
+
+// keep the process owning private frame from writing to it while it is compared
+void
+ksm_protect(unsigned int frame)
+{
+	revoke_pte(vm_info.at(frame_table[frame].slot), frame_table[frame].page_num, true);
+}
+
+// map page vpi read-only onto shared frame, taking a holder of the frame's temp block if it has one
+void
+add_sharer(unsigned int shared, virtual_page_indentifier vpi)
+{
+	frame_info *si = &frame_table[shared];
+	proc_vm_info *info = vm_info.at(vpi.slot);
+	page_extra_info *owner_ei = &vm_info.at(si->slot)->extra_info[si->page_num];
+	if (owner_ei->temped) {
+		swap_space.share(owner_ei->disk_num);
+		set_temp(info, vpi.page_num, owner_ei->disk_num);
+	}
+	info->extra_info[vpi.page_num].res = 1;
+	map_pte(info, vpi.page_num, shared, si->ref);
+	frame_sharers[shared].push_back(vpi);
+}
+
+// move the page in private frame onto shared frame
+void
+ksm_merge(unsigned int shared, unsigned int frame)
+{
+	frame_info *fi = &frame_table[frame];
+	virtual_page_indentifier vpi = {fi->slot, (int)fi->page_num};
+	drop_temp(vm_info.at(fi->slot), fi->page_num);
+	add_sharer(shared, vpi);
+	release_frame(frame);
+	ksm_stats.merged++;
+}
+
+void
+run_ksm()
+{
+	for (unsigned int i = 0; i < ksm_batch; i++) {
+		unsigned int frame = ksm_cursor;
+		ksm_cursor = (ksm_cursor + 1) % private_pages;
+		if (ksm_cursor == 0) {
+			ksm_unstable.clear();
+		}
+		frame_info *fi = &frame_table[frame];
+		if (!fi->in_use || fi->shared || fi->pinned || fi->prefetched) {
+			continue;
+		}
+		unsigned long long hash = page_hash(frame_addr(frame));
+		bool stable = hash == ksm_hash[frame];
+		ksm_hash[frame] = hash;
+		if (!stable) {
+			continue;
+		}
+		ksm_stats.scanned++;
+		if (hash == zero_hash) {
+			ksm_protect(frame);
+			const unsigned long long *word = (const unsigned long long *)frame_addr(frame);
+			unsigned int w = 0;
+			while (w < VM_PAGESIZE / sizeof(unsigned long long) && !word[w]) {
+				w++;
+			}
+			if (w == VM_PAGESIZE / sizeof(unsigned long long)) {
+				ksm_zero(frame);
+				continue;
+			}
+		}
+		unordered_map<unsigned long long, unsigned int>::iterator it = ksm_stable.find(hash);
+		if (it != ksm_stable.end()) {
+			ksm_protect(frame);
+			if (!memcmp(frame_addr(it->second), frame_addr(frame), VM_PAGESIZE)) {
+				ksm_merge(it->second, frame);
+			}
+			continue;
+		}
+		it = ksm_unstable.find(hash);
+		if (it == ksm_unstable.end()) {
+			ksm_unstable[hash] = frame;
+			continue;
+		}
+		unsigned int other = it->second;
+		frame_info *oi = &frame_table[other];
+		if (other == frame || !oi->in_use || oi->shared || oi->pinned || oi->prefetched || ksm_hash[other] != hash) {
+			it->second = frame;
+			continue;
+		}
+		ksm_protect(other);
+		ksm_protect(frame);
+		if (!memcmp(frame_addr(other), frame_addr(frame), VM_PAGESIZE)) {
+			ksm_unstable.erase(it);
+			make_shared(other);
+			ksm_stable[hash] = other;
+			ksm_merge(other, frame);
+		} else {
+			it->second = frame;
+		}
+	}
+}
+
+/**********
+read_ahead(info, page_number): called after page_number was paged in
+	if the last two page-ins of the process had the same stride, page in the next
+	readahead_window pages along that stride that are valid, not resident and have
+	their contents on disk (zero pages are cheap to fault and are skipped), into free
+	frames only and within the process's max_frames: a guess never evicts a page
+	advice of page_number: RANDOM never reads ahead; SEQUENTIAL reads twice the window
+	forward without waiting for a stride, and takes the ref bit of the page behind so it
+	is among the first to go
+	prefetched pages come in unreferenced with read and write disabled, so the first
+	touch faults (a hit) and an untouched page is the policy's first choice to evict (a waste)
+
+	VM_READAHEAD sets the window (default 0, off); VM_READAHEAD_STATS=1 prints
+	issued/hits/wasted to stderr at exit
+**********/
+unsigned int readahead_window;
+
+struct {
+	unsigned long issued;
+	unsigned long hits;
+	unsigned long wasted;
+} readahead_stats;
+
+void
+print_readahead_stats()
+{
+	fprintf(stderr, "readahead window %u issued %lu hits %lu wasted %lu\n", readahead_window,
+		readahead_stats.issued, readahead_stats.hits, readahead_stats.wasted);
+}
+
+// the policy let go of frame: unmap its page(s), writing them out unless disk already has a copy
+// with write_back a disk write is left to the caller, see write_victim
+void
+page_out(unsigned int frame, unsigned long *write_back = 0)
+{
+	// a shared victim is written once for all its pages
+	if (frame_table[frame].shared) {
+		stat_count(STAT_EVICT, 0);
+		evict_shared(frame, write_back);
+		return;
+	}
+	// set victim's !res !read and !write
+	// if victim is temped 
+	//     remove it from temp-map
+	// if victim is 0 page
+	//     do nothing
+	// else
+	//     write disk to a free block (dropping temp blocks until there is one) and set disk num of victim
+	virtual_page_indentifier victim = {frame_table[frame].slot, (int)frame_table[frame].page_num};
+	if (frame_table[frame].prefetched) {
+		readahead_stats.wasted++;
+	}
+	
+	proc_vm_info *victim_info = vm_info.at(victim.slot);
+	page_extra_info *victim_ei = &victim_info->extra_info[victim.page_num];
+	victim_info->resident_frames--;
+	victim_ei->res = 0;
+	stat_count(STAT_EVICT, victim_info);
+	revoke_pte(victim_info, victim.page_num);
+	
+	if (victim_ei->temped) {
+		take_temp(victim_info, victim.page_num);
+		stat_count(STAT_EVICT_TEMP_HIT, victim_info);
+
+	} else if (victim_ei->zero) {
+		victim_ei->disk_num = NO_DISK_BLOCK;
+		stat_count(STAT_EVICT_ZERO, victim_info);
+
+	} else {
+		stat_count(STAT_EVICT_WRITE, victim_info);
+		victim_ei->disk_num = alloc_swap_block(victim_info, victim.slot, victim.page_num);
+		write_victim(victim_ei->disk_num, frame, write_back);
+	}
+}
+
+// read the non-resident page from its block into a free frame, mapped with no access
+// (the first touch faults) and keeping the block as its temp block
+void
+prefetch_page(proc_vm_info *info, int slot, int page, unsigned int frame)
+{
+	page_extra_info *ei = &info->extra_info[page];
+	virtual_page_indentifier vpi = {slot, page};
+	set_temp(info, page, ei->disk_num);
+	read_block(ei->disk_num, frame);
+	map_pte(info, page, frame, false);
+	ei->res = 1;
+	frame_resident(frame, vpi);
+	frame_table[frame].prefetched = 1;
+}
+
+/**********
+load control: suspend a process while memory thrashes (VM_LOAD_CONTROL=<percent>, off by default)
+	thrashing: a working set window (about one sweep of memory) ends with at least percent% of
+	the private frames evicted during it; the sweep keeps finding pages in use and still has
+	to replace a big part of memory
+	the next vm_switch suspends one process: of the live ones other than the process switched to,
+	without a min_frames quota, the one owning the most frames.  Its private pages are paged out
+	in one pass in vpn order until a write would need a block that is not free, and their
+	frames go to the free list.  The dirty ones are written in batches as large as the frames
+	in flight allow (see concurrency), each sorted by block (its swap runs keep them mostly
+	sequential) and written without pager_lock, the frames pinned and the blocks in flight
+	meanwhile like a fault's write-back; the batches need the process's own lock, which keeps
+	its faults and vm_destroy out, and without it (it is busy on another thread) the pages are
+	written under pager_lock one at a time.  While suspended it is held to LOAD_CONTROL_FRAMES
+	frames of its own like a max_frames quota.
+	after VM_LOAD_CONTROL_CALM vm_switch calls (default 64) without a thrashing window the most
+	recently suspended process is restored: the quota is lifted and the pages it lost are read
+	back into free frames, in one pass, as prefetched pages
+**********/
+#define LOAD_CONTROL_FRAMES 2
+unsigned int load_control_percent;
+unsigned int load_control_calm;
+unsigned long load_evictions;	// evictions in the current window
+bool load_thrashing;	// the last window thrashed, the next vm_switch suspends a process
+unsigned int load_calm_switches;
+vector<pid_t> suspended_pids;	// most recent last
+
+struct {
+	unsigned long thrashing;
+	unsigned long paged_out;
+	unsigned long paged_in;
+} load_stats;
+
+// the max_frames quota in effect
+unsigned int
+frame_cap(proc_vm_info *info)
+{
+	if (info->suspended && (!info->max_frames || info->max_frames > LOAD_CONTROL_FRAMES)) {
+		return LOAD_CONTROL_FRAMES;
+	}
+	return info->max_frames;
+}
+
+// a working set window is over, judge it
+void
+load_window_closed()
+{
+	if (load_control_percent && load_evictions * 100 >= (unsigned long)load_control_percent * private_pages) {
+		load_thrashing = true;
+		load_calm_switches = 0;
+		load_stats.thrashing++;
+	}
+	load_evictions = 0;
+}
+
+// the frames of a batch of suspend_process and the blocks they go to
+vector<pair<unsigned long, unsigned int> > suspend_writes;
+
+// write the batch in block order without pager_lock, then free its frames
+void
+write_suspended()
+{
+	sort(suspend_writes.begin(), suspend_writes.end());
+	frames_in_flight += suspend_writes.size();
+	pthread_mutex_unlock(&pager_lock);
+	for (unsigned int i = 0; i < suspend_writes.size(); i++) {
+		disk_write_timed(suspend_writes[i].first, suspend_writes[i].second);
+	}
+	lock_pager();
+	frames_in_flight -= suspend_writes.size();
+	for (unsigned int i = 0; i < suspend_writes.size(); i++) {
+		unsigned int frame = suspend_writes[i].second;
+		write_finished(suspend_writes[i].first);
+		unpin_frame(frame);
+		frame_table[frame].in_use = 0;
+		free_phy_mem_page_list.push_back(frame);
+	}
+	suspend_writes.clear();
+}
+
+void
+suspend_process(int slot)
+{
+	proc_vm_info *info = vm_info.at(slot);
+	// its own lock keeps its faults and vm_destroy out while a batch is written
+	bool locked = !pthread_mutex_trylock(&info->lock);
+	stat_count(STAT_SUSPEND, info);
+	info->suspended = true;
+	info->swapped_pages.clear();
+	suspended_pids.push_back(info->pid);
+	unsigned int limit = 0;
+	for (int i = 0; i < info->top_virtual_page_num; i++) {
+		page_extra_info *ei = &info->extra_info[i];
+		if (!ei->res) {
+			continue;
+		}
+		unsigned int frame = pte_of(info, i)->ppage;
+		if (frame_table[frame].shared || frame_table[frame].pinned) {
+			continue;
+		}
+		if (!ei->temped && !ei->zero && swap_space.empty()) {
+			// every frame freed from here on would need a block the capacity limit did not count on
+			break;
+		}
+		if (suspend_writes.empty()) {
+			// a new batch, as large as the frames in flight allow
+			unsigned int most = (private_pages - 1) / 2;
+			limit = locked && frames_in_flight < most ? most - frames_in_flight : 0;
+		}
+		replacement_policy->page_destroyed(frame);
+		unsigned long block = NO_DISK_BLOCK;
+		page_out(frame, limit ? &block : 0);
+		if (block != NO_DISK_BLOCK) {
+			pin_frame(frame);
+			suspend_writes.push_back(make_pair(block, frame));
+		} else {
+			frame_table[frame].in_use = 0;
+			free_phy_mem_page_list.push_back(frame);
+		}
+		if (ei->disk_num != NO_DISK_BLOCK) {
+			info->swapped_pages.push_back(i);
+		}
+		load_stats.paged_out++;
+		if (limit && suspend_writes.size() == limit) {
+			write_suspended();
+		}
+	}
+	if (!suspend_writes.empty()) {
+		write_suspended();
+	}
+	if (locked) {
+		pthread_mutex_unlock(&info->lock);
+	}
+}
+
+void
+restore_process()
+{
+	int slot = vm_info.slot(suspended_pids.back());
+	suspended_pids.pop_back();
+	proc_vm_info *info = vm_info.at(slot);
+	stat_count(STAT_RESTORE, info);
+	info->suspended = false;
+	for (unsigned int i = 0; i < info->swapped_pages.size() && !free_phy_mem_page_list.empty(); i++) {
+		int page = info->swapped_pages[i];
+		if (page >= info->top_virtual_page_num || !info->extra_info[page].val) {
+			continue;
+		}
+		page_extra_info *ei = &info->extra_info[page];
+		if (ei->res || ei->disk_num == NO_DISK_BLOCK || swap_space.writing(ei->disk_num)) {
+			continue;
+		}
+		unsigned int frame = free_phy_mem_page_list.back();
+		free_phy_mem_page_list.pop_back();
+		prefetch_page(info, slot, page, frame);
+		load_stats.paged_in++;
+	}
+	info->swapped_pages.clear();
+}
+
+void
+run_load_control()
+{
+	if (!load_control_percent) {
+		return;
+	}
+	if (!load_thrashing) {
+		if (!suspended_pids.empty() && ++load_calm_switches >= load_control_calm) {
+			load_calm_switches = 0;
+			restore_process();
+		}
+		return;
+	}
+	load_thrashing = false;
+	int victim = -1;
+	unsigned int running = 0;
+	for (int slot = 0; slot < vm_info.end(); slot++) {
+		proc_vm_info *info = vm_info.at(slot);
+		if (!info || info->suspended) {
+			continue;
+		}
+		running++;
+		if (slot != current_slot && !info->min_frames
+			&& (victim < 0 || info->resident_frames > vm_info.at(victim)->resident_frames)) {
+			victim = slot;
+		}
+	}
+	if (victim >= 0 && running > 1 && vm_info.at(victim)->resident_frames) {
+		suspend_process(victim);
+	}
+}
+
+/**********
+stats_dump: write the statistics to VM_STATS as one JSON object
+	counters and histograms summed over threads, per-process counters under "processes"
+	(keyed by pid) and those of destroyed processes summed under "exited", resident frames, working set, quota and suspension of live processes
+	under "working_sets", and the read-ahead, load control, compressed pool, page merging and
+	syslog counters
+	histogram buckets are [upper bound (exclusive), count] pairs, empty buckets left out
+**********/
+const char *stats_path;
+volatile sig_atomic_t stats_dump_requested;
+
+void
+stats_signal(int)
+{
+	stats_dump_requested = 1;
+}
+
+void
+print_counters(FILE *out, const unsigned long *counters)
+{
+	for (int c = 0; c < STAT_COUNTERS; c++) {
+		fprintf(out, "%s\"%s\": %lu", c ? ", " : "", stat_counter_names[c], counters[c]);
+	}
+}
+
+void
+stats_dump()
+{
+	FILE *out = strcmp(stats_path, "-") ? fopen(stats_path, "w") : stderr;
+	if (!out) {
+		return;
+	}
+	pager_stats *total = (pager_stats *)calloc(1, sizeof(pager_stats));
+	pthread_mutex_lock(&all_stats_lock);
+	for (unsigned int i = 0; i < all_stats.size(); i++) {
+		for (int c = 0; c < STAT_COUNTERS; c++) {
+			total->counters[c] += __atomic_load_n(&all_stats[i]->counters[c], __ATOMIC_RELAXED);
+		}
+		for (int h = 0; h < STAT_HISTOGRAMS; h++) {
+			for (int b = 0; b < STAT_BUCKETS; b++) {
+				total->histograms[h][b] += __atomic_load_n(&all_stats[i]->histograms[h][b], __ATOMIC_RELAXED);
+			}
+			total->sums[h] += __atomic_load_n(&all_stats[i]->sums[h], __ATOMIC_RELAXED);
+		}
+	}
+	pthread_mutex_unlock(&all_stats_lock);
+
+#if defined(__x86_64__) || defined(__i386__)
+	fprintf(out, "{\n\t\"clock\": \"tsc\",\n\t\"counters\": {");
+#else
+	fprintf(out, "{\n\t\"clock\": \"ns\",\n\t\"counters\": {");
+#endif
+	print_counters(out, total->counters);
+	fprintf(out, "},\n\t\"histograms\": {");
+	for (int h = 0; h < STAT_HISTOGRAMS; h++) {
+		unsigned long count = 0;
+		for (int b = 0; b < STAT_BUCKETS; b++) {
+			count += total->histograms[h][b];
+		}
+		fprintf(out, "%s\n\t\t\"%s\": {\"count\": %lu, \"sum\": %llu, \"buckets\": [", h ? "," : "",
+			stat_histogram_names[h], count, total->sums[h]);
+		bool first = true;
+		for (int b = 0; b < STAT_BUCKETS; b++) {
+			if (total->histograms[h][b]) {
+				fprintf(out, "%s[%llu, %lu]", first ? "" : ", ", 1ULL << b, total->histograms[h][b]);
+				first = false;
+			}
+		}
+		fprintf(out, "]}");
+	}
+	fprintf(out, "\n\t},\n\t\"processes\": {");
+	bool first = true;
+	for (unordered_map<pid_t, pid_stats>::iterator it = pid_stats_table.begin(); it != pid_stats_table.end(); ++it) {
+		fprintf(out, "%s\n\t\t\"%d\": {", first ? "" : ",", (int)it->first);
+		print_counters(out, it->second.counters);
+		fprintf(out, "}");
+		first = false;
+	}
+	fprintf(out, "\n\t},\n\t\"exited\": {\"processes\": %lu, ", exited_processes);
+	print_counters(out, exited_stats.counters);
+	fprintf(out, "},\n\t\"working_sets\": {");
+	first = true;
+	for (int slot = 0; slot < vm_info.end(); slot++) {
+		proc_vm_info *info = vm_info.at(slot);
+		if (info) {
+			fprintf(out, "%s\n\t\t\"%d\": {\"resident\": %u, \"working_set\": %u, \"min\": %u, \"max\": %u, \"suspended\": %s}",
+				first ? "" : ",", (int)info->pid, info->resident_frames,
+				ws_windows ? info->working_set : info->resident_frames, info->min_frames, info->max_frames,
+				info->suspended ? "true" : "false");
+			first = false;
+		}
+	}
+	fprintf(out, "\n\t},\n");
+	fprintf(out, "\t\"readahead\": {\"window\": %u, \"issued\": %lu, \"hits\": %lu, \"wasted\": %lu},\n",
+		readahead_window, readahead_stats.issued, readahead_stats.hits, readahead_stats.wasted);
+	fprintf(out, "\t\"load_control\": {\"percent\": %u, \"thrashing\": %lu, \"suspended\": %u, \"paged_out\": %lu, \"paged_in\": %lu},\n",
+		load_control_percent, load_stats.thrashing, (unsigned int)suspended_pids.size(),
+		load_stats.paged_out, load_stats.paged_in);
+	fprintf(out, "\t\"zswap\": {\"frames\": %u, \"stored\": %lu, \"rejected\": %lu, \"loads\": %lu, \"spilled\": %lu, \"live\": %lu, \"live_bytes\": %lu},\n",
+		pool_frames, pool_stats.stored, pool_stats.rejected, pool_stats.loads, pool_stats.spilled,
+		(unsigned long)pool_index.size(), pool_stats.live_bytes);
+	fprintf(out, "\t\"ksm\": {\"scanned\": %lu, \"merged\": %lu, \"zeroed\": %lu, \"cow\": %lu},\n",
+		ksm_stats.scanned, ksm_stats.merged, ksm_stats.zeroed, ksm_stats.cow);
+	fprintf(out, "\t\"syslog\": {\"records\": %lu, \"bytes\": %lu, \"dropped\": %lu, \"dropped_bytes\": %lu}\n}\n",
+		log_stats.records.load(), log_stats.bytes.load(),
+		log_stats.dropped_records.load(), log_stats.dropped_bytes.load());
+	free(total);
+	if (out == stderr) {
+		fflush(out);
+	} else {
+		fclose(out);
+	}
+}
+
+// dump now if SIGUSR1 asked for it since the last call
+void
+stats_poll()
+{
+	if (stats_dump_requested) {
+		stats_dump_requested = 0;
+		stats_dump();
+	}
+}
+
+/**********
+trace: VM_TRACE=<file> records every event the pager sees as vm_trace_records (vm_trace.h)
+	faults are the only references the pager sees, so the trace is the reference string as
+	the policies see it: pages hit without a fault are missing, the faults ref-bit sampling
+	causes are there
+	records are buffered TRACE_BUFFER at a time and flushed when the buffer fills and at exit
+	with several pager threads the records of their processes interleave: a record of another
+	process than trace_pid, the last one traced, is preceded by a SWITCH to it
+	native/trace_sim replays a trace against policies and OPT offline
+**********/
+#define TRACE_BUFFER 4096
+int trace_fd = -1;
+vm_trace_record_t trace_buffer[TRACE_BUFFER];
+unsigned int trace_used;
+pid_t trace_pid = -1;	// the current process as the trace has it
+
+void
+trace_flush()
+{
+	if (trace_used && write(trace_fd, trace_buffer, trace_used * sizeof(vm_trace_record_t)) < 0) {
+		perror("VM_TRACE");
+	}
+	trace_used = 0;
+}
+
+void
+trace_record(unsigned int op, unsigned int count, unsigned int value)
+{
+	trace_buffer[trace_used].op = op | count << 4;
+	trace_buffer[trace_used].value = value;
+	if (++trace_used == TRACE_BUFFER) {
+		trace_flush();
+	}
+}
+
+void
+trace_event(unsigned int op, unsigned int count, unsigned int value)
+{
+	if (trace_fd < 0) {
+		return;
+	}
+	if (op == VM_TRACE_SWITCH) {
+		trace_pid = value;
+	} else if (op != VM_TRACE_CREATE && op != VM_TRACE_PARENT && op != VM_TRACE_FORK
+			&& current_pid != trace_pid) {
+		// another thread's process was traced last
+		trace_record(VM_TRACE_SWITCH, 0, current_pid);
+		trace_pid = current_pid;
+	}
+	trace_record(op, count, value);
+}
+
+void
+trace_init()
+{
+	const char *file = getenv("VM_TRACE");
+	if (!file) {
+		return;
+	}
+	trace_fd = open(file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (trace_fd < 0 || write(trace_fd, VM_TRACE_MAGIC, 8) != 8) {
+		perror("VM_TRACE");
+		trace_fd = -1;
+		return;
+	}
+	atexit(trace_flush);
+}
+
+/**********
+fuction definition
+
+vm_init: Make a linked list of memory_pages and disk_blocks
+
+vm_create(pid): create vm info of this process
+
+vm_fork(parent, child): create vm info of child sharing every page of parent
+
+vm_set_quota(pid, min, max), vm_working_set(pid), vm_resident(pid): see "working sets and quotas"
+
+vm_release(addr, npages), vm_advise(addr, npages, advice): give pages back, steer read-ahead
+
+vm_switch(pid): set current_pid and page_table_register
+**********/
+
+void 
+vm_init(unsigned int memory_pages, unsigned int disk_blocks)
+{
+	// the last frame becomes the shared zero frame unless it is the only one
+	private_pages = memory_pages;
+	if (memory_pages >= 2) {
+		private_pages = memory_pages - 1;
+		zero_frame = private_pages;
+		memset((char*)pm_physmem + zero_frame * VM_PAGESIZE, 0, VM_PAGESIZE);
+	}
+	// the compressed pool and its bounce frame come next, at least two frames stay private
+	const char *zswap = getenv("VM_ZSWAP");
+	unsigned int pool = zswap ? private_pages * atoi(zswap) / 100 : 0;
+	if (pool && private_pages >= pool + 1 + 2) {
+		private_pages -= pool + 1;
+		pool_init(private_pages, pool);
+	}
+	for (unsigned int i = 0; i < private_pages; i++) {
+		free_phy_mem_page_list.push_back(i);
+	}
+	swap_space.init(disk_blocks);
+
+	sparse_page_table = getenv("VM_SPARSE_PAGE_TABLE") != 0;
+
+	frame_table = (frame_info *)calloc(memory_pages + FRAME_RING_HEADS, sizeof(frame_info));
+	replacement_policy = new_replacement_policy(getenv("VM_PAGER_POLICY"), memory_pages);
+	temp_disk_block_map.reserve(memory_pages);
+	valid_page_limit = private_pages + disk_blocks - (disk_blocks > 0);
+	data_page_limit = valid_page_limit;
+	const char *overcommit = getenv("VM_OVERCOMMIT");
+	overcommit_percent = overcommit && atoi(overcommit) > 100 ? atoi(overcommit) : 0;
+	if (overcommit_percent) {
+		valid_page_limit = valid_page_limit * overcommit_percent / 100;
+	}
+
+	const char *reserve = getenv("VM_CLEANER_RESERVE");
+	const char *batch = getenv("VM_CLEANER_BATCH");
+	cleaner_reserve = reserve ? atoi(reserve) : memory_pages / 16;
+	cleaner_batch = batch ? atoi(batch) : 32;
+
+	const char *window = getenv("VM_READAHEAD");
+	readahead_window = window ? atoi(window) : 0;
+	if (getenv("VM_READAHEAD_STATS")) {
+		atexit(print_readahead_stats);
+	}
+
+	const char *load = getenv("VM_LOAD_CONTROL");
+	load_control_percent = load ? atoi(load) : 0;
+	const char *calm = getenv("VM_LOAD_CONTROL_CALM");
+	load_control_calm = calm ? atoi(calm) : 64;
+
+	const char *ksm = getenv("VM_KSM");
+	ksm_batch = ksm && private_pages >= 2 ? atoi(ksm) : 0;
+	ksm_hash.assign(private_pages, 0);
+	if (ksm_batch) {
+		char *zeros = (char *)calloc(1, VM_PAGESIZE);
+		zero_hash = page_hash(zeros);
+		free(zeros);
+	}
+	if (getenv("VM_KSM_STATS")) {
+		atexit(print_ksm_stats);
+	}
+	log_init();
+	trace_init();
+
+	stats_path = getenv("VM_STATS");
+	if (stats_path) {
+		atexit(stats_dump);
+		signal(SIGUSR1, stats_signal);
+	}
+}
+
+// vm info of exited processes, page table cleared and vectors emptied; beyond SPARE_INFOS of
+// them their page tables are freed and vectors shrunk, see vm_destroy
+#define SPARE_INFOS 16
+vector<proc_vm_info *> spare_infos;
+
+proc_vm_info *
+new_proc_vm_info(pid_t pid)
+{
+	proc_vm_info *info;
+	if (spare_infos.empty()) {
+		info = new proc_vm_info();
+		pthread_mutex_init(&info->lock, 0);
+		pthread_mutex_init(&info->mmu_lock, 0);
+		if (!sparse_page_table) {
+			info->page_table = (page_table_t *)calloc(1, sizeof(page_table_t));
+		}
+	} else {
+		info = spare_infos.back();
+		spare_infos.pop_back();
+		if (!sparse_page_table && !info->page_table) {
+			info->page_table = (page_table_t *)calloc(1, sizeof(page_table_t));
+		}
+	}
+	info->pid = pid;
+	info->stats = pid_stats_table[pid].counters;
+	return info;
+}
+
+// the vm info of pid, 0 if there is none; its own lock is not taken
+proc_vm_info *
+lookup_process(pid_t pid)
+{
+	Pager_lock lock;
+	int slot = vm_info.slot(pid);
+	return slot < 0 ? 0 : vm_info.at(slot);
+}
+
+void 
+vm_create(pid_t pid)
+{
+	Pager_lock lock;
+	trace_event(VM_TRACE_CREATE, 0, pid);
+	vm_info.insert(pid, new_proc_vm_info(pid));
+}
+
+/**********
+vm_fork(parent, child)
+	fail if parent does not exist, child does, or the copy would pass valid_page_limit
+	(every shared page may need a private frame or block of its own later), or when
+	overcommitted data_page_limit
+	fail with fewer than two private frames: a copy-on-write fault copies the shared
+	frame into a second one
+	create vm info of child with the same top_vm_page and claim its swap runs (unless overcommitted)
+	for each valid page of parent
+		zero page: child page is a zero page too
+		resident: make the frame shared (parent page first) and map child page read-only on it,
+			child holds the temp block as well if parent page has one
+		non-resident: child page holds parent's disk block as well
+**********/
+int
+vm_fork(pid_t parent, pid_t child)
+{
+	Stat_timer timer(HIST_FORK);
+	proc_vm_info *parent_info = lookup_process(parent);
+	if (!parent_info) {
+		return -1;
+	}
+	Pager_lock lock(parent_info);
+	// parent may have been destroyed while this waited for its lock
+	int parent_slot = vm_info.slot(parent);
+	if (parent_slot < 0 || vm_info.at(parent_slot) != parent_info || vm_info.slot(child) >= 0
+			|| private_pages < 2) {
+		return -1;
+	}
+	int top = parent_info->top_virtual_page_num;
+	if (valid_pages + parent_info->valid_page_count > valid_page_limit) {
+		return -1;
+	}
+	unsigned long parent_data = 0;
+	for (int i = 0; i < top; i++) {
+		parent_data += !parent_info->extra_info[i].zero;
+	}
+	if (overcommit_percent && data_pages + parent_data > data_page_limit) {
+		return -1;
+	}
+	valid_pages += parent_info->valid_page_count;
+	data_pages += parent_data;
+	stat_count(STAT_FORK, parent_info);
+	trace_event(VM_TRACE_PARENT, 0, parent);
+	trace_event(VM_TRACE_FORK, 0, child);
+
+	proc_vm_info *info = new_proc_vm_info(child);
+	info->top_virtual_page_num = top;
+	info->valid_page_count = parent_info->valid_page_count;
+	if (sparse_page_table) {
+		for (int c = 0; c * PTE_CHUNK < top; c++) {
+			info->pt_chunks.push_back((page_table_entry_t *)calloc(PTE_CHUNK, sizeof(page_table_entry_t)));
+		}
+	}
+	int slot = vm_info.insert(child, info);
+	info->extra_info = parent_info->extra_info;
+	for (int i = 0; i < top; i++) {
+		if (i % swap_space.run_size == 0 && !overcommit_percent) {
+			swap_space.reserve(info, slot, i);
+		}
+		page_extra_info *ei = &info->extra_info[i];
+		ei->ws_window = 0;
+		if (ei->res) {
+			unsigned int frame = pte_of(parent_info, i)->ppage;
+			if (!frame_table[frame].shared) {
+				make_shared(frame);
+			}
+			virtual_page_indentifier vpi = {slot, i};
+			// add_sharer sets these again if the frame has a temp block
+			ei->temped = 0;
+			ei->disk_num = NO_DISK_BLOCK;
+			add_sharer(frame, vpi);
+		} else if (ei->disk_num != NO_DISK_BLOCK) {
+			swap_space.share(ei->disk_num);
 		}
-		if (ei.init) {
-			memset((char*)pm_physmem+info->page_table.ptes[page_number].ppage * VM_PAGESIZE,0,VM_PAGESIZE);
+	}
+	return 0;
+}
+
+int
+vm_set_quota(pid_t pid, unsigned int min_frames, unsigned int max_frames)
+{
+	Pager_lock lock;
+	int slot = vm_info.slot(pid);
+	if (slot < 0 || (max_frames && min_frames > max_frames)) {
+		return -1;
+	}
+	proc_vm_info *info = vm_info.at(slot);
+	if (min_frames_total - info->min_frames + min_frames >= private_pages) {
+		return -1;
+	}
+	min_frames_total += min_frames - info->min_frames;
+	info->min_frames = min_frames;
+	info->max_frames = max_frames;
+	return 0;
+}
+
+int
+vm_working_set(pid_t pid)
+{
+	Pager_lock lock;
+	int slot = vm_info.slot(pid);
+	if (slot < 0) {
+		return -1;
+	}
+	proc_vm_info *info = vm_info.at(slot);
+	return ws_windows ? info->working_set : info->resident_frames;
+}
+
+int
+vm_resident(pid_t pid)
+{
+	Pager_lock lock;
+	int slot = vm_info.slot(pid);
+	if (slot < 0) {
+		return -1;
+	}
+	return vm_info.at(slot)->resident_frames;
+}
+
+void 
+vm_switch(pid_t pid)
+{
+	Stat_timer timer(HIST_SWITCH);
+	Pager_lock lock;
+	stats_poll();
+	int slot = vm_info.slot(pid);
+	proc_vm_info *info = vm_info.at(slot);
+	stat_count(STAT_SWITCH, info);
+	trace_event(VM_TRACE_SWITCH, 0, pid);
+	if (sparse_page_table && !live_page_table) {
+		live_page_table = (page_table_t *)calloc(1, sizeof(page_table_t));
+	}
+	if (sparse_page_table && info->live_table != live_page_table) {
+		if (live_info && live_info->live_table == live_page_table) {
+			swap_out_page_table(live_info);
 		}
-		info->extra_info[page_number] = new_ei;
+		// it ran on another thread last
+		if (info->live_table) {
+			swap_out_page_table(info);
+		}
+		swap_in_page_table(info);
+		live_info = info;
+	}
+	current_pid = pid;
+	current_slot = slot;
+	current_info = info;
+	page_table_base_register = sparse_page_table ? live_page_table : info->page_table;
+	thread_page_table = page_table_base_register;
 
-	} else {
-		page_extra_info new_ei = {1,1,1,ei.dirt,0,ei.zero,ei.disk_num,ei.clock_node};
-		info->page_table.ptes[page_number].read_enable = 1;
-		if (ei.init) {
-			memset((char*)pm_physmem+info->page_table.ptes[page_number].ppage * VM_PAGESIZE,0,VM_PAGESIZE);
+	run_ksm();
+	run_cleaner();
+	run_load_control();
+}
+
+// the MMU's side of "concurrency", see vm_pager.h
+page_table_t *
+vm_mmu_lock()
+{
+	pthread_mutex_lock(&current_info->mmu_lock);
+	return thread_page_table;
+}
+
+void
+vm_mmu_unlock()
+{
+	pthread_mutex_unlock(&current_info->mmu_lock);
+}
+
+/**********
+vm_extend_n(count)
+	if count is 0, or count more valid pages would pass valid_page_limit (private frames +
+	disk_blocks - 1, more when overcommitted) or the end of the arena:
+		return 0, nothing changes
+	the new pages are zero pages: they take no frame and no block until they are written
+	(a read maps zero_frame), the limit alone guarantees both exist by then unless overcommitted
+	claim the swap run of every stretch the new pages start or reach into, unless overcommitted
+	set new pages extra_info: val=1, res=0, zero=1, temped=0, advice=normal, disk_num=none
+	update top_vm_page
+	return the first new page
+vm_extend() is vm_extend_n(1)
+**********/
+void *
+vm_extend_n(unsigned int count)
+{
+	Stat_timer timer(HIST_EXTEND);
+	proc_vm_info *info = current_info;
+	Pager_lock lock(info);
+	unsigned int top = info->top_virtual_page_num;
+	if (count == 0 || count > valid_page_limit - valid_pages || count > VM_ARENA_SIZE / VM_PAGESIZE - top) {
+		stat_count(STAT_EXTEND_FAIL, info);
+		return 0;
+	}
+	stat_count(STAT_EXTEND, info);
+	trace_event(VM_TRACE_EXTEND, count, top);
+	valid_pages += count;
+	info->valid_page_count += count;
+	if (sparse_page_table) {
+		// the live rows of these chunks are already zero, swap_out fills them
+		while (info->pt_chunks.size() * PTE_CHUNK < top + count) {
+			info->pt_chunks.push_back((page_table_entry_t *)calloc(PTE_CHUNK, sizeof(page_table_entry_t)));
+		}
+	}
+	for (unsigned int page = top; page < top + count && !overcommit_percent; page++) {
+		if (page == top || page % swap_space.run_size == 0) {
+			swap_space.reserve(info, current_slot, page);
+		}
+	}
+
+	page_extra_info ei = {1,0,1,0,VM_ADVICE_NORMAL,0,NO_DISK_BLOCK};
+	info->extra_info.insert(info->extra_info.end(), count, ei);
+
+	info->top_virtual_page_num += count;
+	return (void*)((char*)VM_ARENA_BASEADDR + VM_PAGESIZE*(unsigned long)top);
+}
+
+void * 
+vm_extend()
+{
+	return vm_extend_n(1);
+}
+
+// give back the frame and block of a valid page and clear its PTE; it becomes a zero page
+void
+drop_page(proc_vm_info *info, int slot, int page)
+{
+	page_extra_info *ei = &info->extra_info[page];
+	page_table_entry_t *pte = pte_of(info, page);
+	if (ei->res) {
+		unsigned int frame = pte->ppage;
+		if (frame_table[frame].shared) {
+			virtual_page_indentifier vpi = {slot, page};
+			drop_sharer(frame, vpi);
+		} else {
+			if (frame_table[frame].prefetched) {
+				readahead_stats.wasted++;
+			}
+			release_frame(frame);
+		}
+		drop_temp(info, page);
+	} else if (ei->disk_num != NO_DISK_BLOCK) {
+		swap_space.free(ei->disk_num);
+	}
+	pte->read_enable = 0;
+	pte->write_enable = 0;
+	if (!ei->zero) {
+		data_pages--;
+	}
+	ei->res = 0;
+	ei->zero = 1;
+	ei->disk_num = NO_DISK_BLOCK;
+}
+
+// first page of [addr, addr + npages pages) if it is page aligned and every page in it is valid, else -1
+long
+valid_range(proc_vm_info *info, void *addr, unsigned int npages)
+{
+	unsigned long offset = (unsigned long)addr - (unsigned long)VM_ARENA_BASEADDR;
+	if ((unsigned long)addr < (unsigned long)VM_ARENA_BASEADDR || offset % VM_PAGESIZE || npages == 0) {
+		return -1;
+	}
+	unsigned long first = offset / VM_PAGESIZE;
+	if (first >= (unsigned long)info->top_virtual_page_num || npages > info->top_virtual_page_num - first) {
+		return -1;
+	}
+	for (unsigned long page = first; page < first + npages; page++) {
+		if (!info->extra_info[page].val) {
+			return -1;
+		}
+	}
+	return first;
+}
+
+/**********
+vm_release(addr, npages)
+	fail if the range is not page aligned or not all valid
+	for each page: return its frame and block (drop_page), and make it invalid
+	the pages no longer count against valid_page_limit, and leave swapped_pages
+	if the range reached the top of the arena, lower top_vm_page past every trailing invalid
+	page, free the page table chunks and give up the swap runs above it, so vm_extend
+	hands the pages out again
+**********/
+int
+vm_release(void *addr, unsigned int npages)
+{
+	proc_vm_info *info = current_info;
+	Pager_lock lock(info);
+	long first = valid_range(info, addr, npages);
+	if (first < 0) {
+		return -1;
+	}
+	stat_count(STAT_RELEASE, info);
+	trace_event(VM_TRACE_RELEASE, npages, first);
+	for (long page = first; page < first + npages; page++) {
+		drop_page(info, current_slot, page);
+		info->extra_info[page].val = 0;
+	}
+	// load control must not read them back on restore
+	vector<int> &swapped = info->swapped_pages;
+	for (unsigned int i = 0; i < swapped.size(); ) {
+		if (swapped[i] >= first && swapped[i] < first + npages) {
+			swapped[i] = swapped.back();
+			swapped.pop_back();
+		} else {
+			i++;
 		}
-		info->extra_info[page_number] = new_ei;
 	}
+	valid_pages -= npages;
+	info->valid_page_count -= npages;
 
+	int top = info->top_virtual_page_num;
+	while (top > 0 && !info->extra_info[top - 1].val) {
+		top--;
+	}
+	info->top_virtual_page_num = top;
+	info->extra_info.resize(top);
+	if (sparse_page_table) {
+		// their live rows were cleared with the PTEs
+		while (info->pt_chunks.size() * PTE_CHUNK >= (unsigned long)top + PTE_CHUNK) {
+			free(info->pt_chunks.back());
+			info->pt_chunks.pop_back();
+		}
+	}
+	swap_space.release(info, current_slot, (top + swap_space.run_size - 1) / swap_space.run_size);
 	return 0;
 }
-/*
-page 
 
-*/
-int 
-vm_syslog(void *message, unsigned int len)
+/**********
+vm_advise(addr, npages, advice)
+	fail if the range is not page aligned or not all valid
+	NORMAL, SEQUENTIAL, RANDOM: remembered per page, read_ahead follows it
+	WILLNEED: page in every page of the range with its contents on disk, into free frames
+		only (it never evicts) and within the process's max_frames, as prefetched pages
+	DONTNEED: drop the contents: every page becomes a zero page again, its frame and
+		block go back to the free lists, it stays valid
+**********/
+int
+vm_advise(void *addr, unsigned int npages, int advice)
+{
+	proc_vm_info *info = current_info;
+	Pager_lock lock(info);
+	long first = valid_range(info, addr, npages);
+	if (first < 0 || advice < VM_ADVICE_NORMAL || advice > VM_ADVICE_DONTNEED) {
+		return -1;
+	}
+	stat_count(STAT_ADVISE, info);
+	if (advice == VM_ADVICE_DONTNEED) {
+		trace_event(VM_TRACE_DISCARD, npages, first);
+	}
+	for (long page = first; page < first + npages; page++) {
+		page_extra_info *ei = &info->extra_info[page];
+		if (advice == VM_ADVICE_DONTNEED) {
+			drop_page(info, current_slot, page);
+		} else if (advice == VM_ADVICE_WILLNEED) {
+			if (free_phy_mem_page_list.empty() || (frame_cap(info) && info->resident_frames >= frame_cap(info))) {
+				break;
+			}
+			if (ei->res || ei->disk_num == NO_DISK_BLOCK || swap_space.writing(ei->disk_num)) {
+				continue;
+			}
+			unsigned int frame = free_phy_mem_page_list.back();
+			free_phy_mem_page_list.pop_back();
+			prefetch_page(info, current_slot, page, frame);
+			readahead_stats.issued++;
+		} else {
+			ei->advice = advice;
+		}
+	}
+	return 0;
+}
+/**********
+vm_destroy()
+	for each valid page in current process
+		if it is resident
+			shared frame: just drop this page from its sharers
+			private frame: tell the replacement policy and collect the frame
+			if it is temped
+				delete it in temp-map and collect its block
+		if it is non-resident
+			collect its disk block
+	return the collected frames and blocks to their free lists in one go
+	clear its page table and keep its proc_vm_info for the next vm_create; it is never freed,
+	a vm_fork of it may wait on its lock, but beyond SPARE_INFOS spare ones its page table is
+	freed and its vectors are shrunk to nothing
+	add its counters to exited_stats and drop its pid_stats
+	the cost is O(pages of this process), nothing walks all of memory
+***********/
+vector<unsigned long> destroy_frames, destroy_blocks;
+
+void 
+vm_destroy()
+{
+	Stat_timer timer(HIST_DESTROY);
+	log_write_buffer();
+	proc_vm_info *info = current_info;
+	pthread_mutex_lock(&info->lock);
+	lock_pager();
+	stat_count(STAT_DESTROY, info);
+	trace_event(VM_TRACE_DESTROY, 0, info->pid);
+	int top = info->top_virtual_page_num;
+	destroy_frames.clear();
+	destroy_blocks.clear();
+	for (int i = 0; i < top; i++) {
+		page_extra_info *ei = &info->extra_info[i];
+		data_pages -= !ei->zero;
+		if (ei->res) {
+			unsigned int frame = pte_of(info, i)->ppage;
+			if (frame_table[frame].shared) {
+				virtual_page_indentifier vpi = {current_slot, i};
+				drop_sharer(frame, vpi);
+			} else {
+				if (frame_table[frame].prefetched) {
+					readahead_stats.wasted++;
+				}
+				replacement_policy->page_destroyed(frame);
+				info->resident_frames--;
+				frame_table[frame].in_use = 0;
+				destroy_frames.push_back(frame);
+			}
+			if (ei->temped) {
+				temp_disk_block_map.erase(page_key(info->pid, i));
+				destroy_blocks.push_back(ei->disk_num);
+			}
+		} else if (ei->disk_num != NO_DISK_BLOCK) {
+			destroy_blocks.push_back(ei->disk_num);
+		}
+	}
+	free_phy_mem_page_list.insert(free_phy_mem_page_list.end(), destroy_frames.begin(), destroy_frames.end());
+	swap_space.free_all(destroy_blocks);
+	swap_space.release(info, current_slot);
+	valid_pages -= info->valid_page_count;
+	if (sparse_page_table) {
+		// clear its live rows, the next vm_switch of this thread copies nothing back
+		for (unsigned int c = 0; c < info->pt_chunks.size(); c++) {
+			if (info->live_table) {
+				memset(&info->live_table->ptes[c * PTE_CHUNK], 0, PTE_CHUNK * sizeof(page_table_entry_t));
+			}
+			free(info->pt_chunks[c]);
+		}
+		info->pt_chunks.clear();
+		info->live_table = 0;
+	} else {
+		memset(info->page_table->ptes, 0, top * sizeof(page_table_entry_t));
+	}
+	vm_info.erase(current_pid);
+	current_info = 0;
+	thread_page_table = 0;
+	for (int c = 0; c < STAT_COUNTERS; c++) {
+		exited_stats.counters[c] += info->stats[c];
+	}
+	exited_processes++;
+	pid_stats_table.erase(info->pid);
+	// nothing can find it any more; a spare info is only handed out under pager_lock
+	pthread_mutex_unlock(&info->lock);
+	min_frames_total -= info->min_frames;
+	if (info->suspended) {
+		suspended_pids.erase(find(suspended_pids.begin(), suspended_pids.end(), info->pid));
+	}
+	info->extra_info.clear();
+	info->top_virtual_page_num = 0;
+	info->valid_page_count = 0;
+	info->last_fault_page = 0;
+	info->fault_stride = 0;
+	info->fault_run = 0;
+	info->resident_frames = 0;
+	info->ws_refs = 0;
+	info->working_set = 0;
+	info->min_frames = 0;
+	info->max_frames = 0;
+	info->suspended = false;
+	info->swapped_pages.clear();
+	if (spare_infos.size() >= SPARE_INFOS) {
+		// not deleted, a vm_fork may still wait on its lock: only its storage goes
+		vector<page_extra_info>().swap(info->extra_info);
+		vector<int>().swap(info->swapped_pages);
+		vector<page_table_entry_t *>().swap(info->pt_chunks);
+		free(info->page_table);
+		info->page_table = 0;
+	}
+	spare_infos.push_back(info);
+	pthread_mutex_unlock(&pager_lock);
+}
+
+/**********
+overcommit (VM_OVERCOMMIT=<percent> above 100, off by default)
+	valid_page_limit becomes percent% of private frames + disk_blocks - 1, so processes can
+	extend more pages than memory and disk hold together; vm_extend and vm_fork only count
+	the pages, the swap run of a stretch is claimed when its first page is written out
+	data_pages (valid pages that are not zero pages, a forked page counted once per process)
+	stays within private frames + disk_blocks - 1: a write fault that would make a zero page
+	the one past it and a vm_fork that would copy past it fail.  Any content then has a frame
+	or a block, so with every block taken some frame is clean and a fault finds a victim
+	once every block is taken only a frame whose page(s) need no new block can be evicted:
+	a zero page, a page with a temp block, or a shared frame all of whose pages have one.
+	clean_victim looks for one in the policy's eviction order, then in the whole frame table;
+	without one, or for a write past data_page_limit, the fault fails (vm_fault returns -1,
+	counted as fault_oom)
+**********/
+#define NO_FREE_FRAME ((unsigned long)-1)
+vector<unsigned int> clean_frames;
+
+// paging the frame out needs no new block
+bool
+frame_is_clean(unsigned int frame)
+{
+	frame_info *fi = &frame_table[frame];
+	if (!fi->shared) {
+		return page_is_clean(vm_info.at(fi->slot), fi->page_num);
+	}
+	vector<virtual_page_indentifier> &pages = frame_sharers[frame];
+	for (unsigned int i = 0; i < pages.size(); i++) {
+		if (!vm_info.at(pages[i].slot)->extra_info[pages[i].page_num].temped) {
+			return false;
+		}
+	}
+	return true;
+}
+
+unsigned long
+clean_victim()
+{
+	clean_frames.clear();
+	replacement_policy->eviction_order(clean_frames, private_pages);
+	for (unsigned int frame = 0; frame < private_pages; frame++) {
+		clean_frames.push_back(frame);
+	}
+	for (unsigned int i = 0; i < clean_frames.size(); i++) {
+		unsigned int frame = clean_frames[i];
+		frame_info *fi = &frame_table[frame];
+		if (fi->in_use && !fi->pinned && frame_is_clean(frame)) {
+			replacement_policy->page_destroyed(frame);
+			page_out(frame);
+			return frame;
+		}
+	}
+	return NO_FREE_FRAME;
+}
+
+/**********
+get_free_frame(write_back)
+	pop free_phy_mem_list if it is not empty, otherwise evict the policy's victim
+	with write_back the victim's disk write is left to the caller (see write_victim)
+	a current process at its max_frames (or suspended) evicts one of its own pages instead
+	an overcommitted pager out of blocks evicts clean_victim, NO_FREE_FRAME if there is none
+	close the working set window after about one sweep
+**********/
+unsigned long
+get_free_frame(unsigned long *write_back = 0)
+{
+	proc_vm_info *info = current_info;
+	unsigned int cap = frame_cap(info);
+	// evicting while frames are free needs a block the capacity limit did not count on
+	bool at_max = cap && info->resident_frames >= cap
+		&& info->resident_frames > pinned_frames && !swap_space.empty();
+	if (!free_phy_mem_page_list.empty() && !at_max) {
+		unsigned long free_page = free_phy_mem_page_list.back();
+		free_phy_mem_page_list.pop_back();
+		return free_page;
+	}
+	if (overcommit_percent && swap_space.empty()) {
+		load_evictions++;
+		return clean_victim();
+	}
+	quota_local_slot = at_max ? current_slot : -1;
+	quota_active = at_max || min_frames_total;
+	quota_refused = 0;
+	if (at_max) {
+		stat_count(STAT_QUOTA_LOCAL, info);
+	}
+	unsigned long scanned = clear_ref_count;
+	unsigned long free_page = replacement_policy->choose_victim();
+	stat_value(HIST_VICTIM_SCAN, clear_ref_count - scanned + 1);
+	quota_active = false;
+	load_evictions++;
+	if (clear_ref_count - ws_window_start >= private_pages) {
+		load_window_closed();
+		ws_roll();
+	}
+	page_out(free_page, write_back);
+	return free_page;
+}
+
+void
+read_ahead(proc_vm_info *info, unsigned long page_number)
 {
-	unsigned long start_page = ((unsigned long)message-(unsigned long)VM_ARENA_BASEADDR)/VM_PAGESIZE;
-	unsigned long end_page = ((unsigned long)message+len-(unsigned long)VM_ARENA_BASEADDR - 1)/VM_PAGESIZE;
+	int stride = (int)page_number - info->last_fault_page;
+	if (stride != 0 && stride == info->fault_stride) {
+		info->fault_run++;
+	} else {
+		info->fault_stride = stride;
+		info->fault_run = 0;
+	}
+	info->last_fault_page = page_number;
+	unsigned int advice = info->extra_info[page_number].advice;
+	unsigned int window = readahead_window;
+	if (advice == VM_ADVICE_RANDOM) {
+		return;
+	}
+	if (advice == VM_ADVICE_SEQUENTIAL) {
+		stride = 1;
+		window *= 2;
+		if (page_number > 0 && info->extra_info[page_number - 1].res) {
+			unsigned int behind = pte_of(info, page_number - 1)->ppage;
+			if (frame_table[behind].ref && !frame_table[behind].shared) {
+				clear_ref(behind);
+			}
+		}
+	} else if (info->fault_run == 0) {
+		return;
+	}
+	long page = page_number;
+	for (unsigned int i = 0; i < window; i++) {
+		page += stride;
+		if (page < 0 || page >= info->top_virtual_page_num) {
+			break;
+		}
+		if (free_phy_mem_page_list.empty() || (frame_cap(info) && info->resident_frames >= frame_cap(info))) {
+			break;
+		}
+		page_extra_info *ei = &info->extra_info[page];
+		if (ei->res || ei->zero || ei->disk_num == NO_DISK_BLOCK || swap_space.writing(ei->disk_num)) {
+			continue;
+		}
+		unsigned int frame = free_phy_mem_page_list.back();
+		free_phy_mem_page_list.pop_back();
+		prefetch_page(info, current_slot, page, frame);
+		readahead_stats.issued++;
+	}
+}
 
-	if (len == 0)
+// vm_fault with the locks held; may_unlock lets the disk I/O of a page-in run without pager_lock
+int
+fault_page(void *addr, bool write_flag, bool may_unlock)
+{
+	Stat_timer timer(write_flag ? HIST_FAULT_WRITE : HIST_FAULT_READ);
+	unsigned long page_number = ((unsigned long)addr - (unsigned long)VM_ARENA_BASEADDR) / VM_PAGESIZE;
+	proc_vm_info *info = current_info;
+	if (page_number >= (unsigned long)info->top_virtual_page_num) {
+		stat_count(STAT_FAULT_INVALID, info);
 		return -1;
-	proc_vm_info *info = vm_info[current_pid];
-	if (info->top_virtual_page_num <= end_page)
+	}
+	stat_count(write_flag ? STAT_FAULT_WRITE : STAT_FAULT_READ, info);
+	virtual_page_indentifier vpi = {current_slot, (int)page_number};
+	page_table_entry_t *pte = pte_of(info, page_number);
+	page_extra_info ei = info->extra_info[page_number];
+	if (!ei.val) {
+		stat_count(STAT_FAULT_INVALID, info);
 		return -1;
-	char *result = (char *)calloc(len+1, sizeof(char));
-	unsigned long len_cal = 0;
-	for (unsigned int i = start_page; i<= end_page; i++){
-		// read from addr_start to addr_end;
-		// addr_start = max(this page_top, message)
-		// addr_end = min(this page_bottom, message + len - 1)
-		unsigned long page_sta = (unsigned long)VM_ARENA_BASEADDR + VM_PAGESIZE * i;
-		unsigned long page_end = (unsigned long)VM_ARENA_BASEADDR + VM_PAGESIZE * i + VM_PAGESIZE - 1;
-		unsigned long sta_offset = 0;
-		unsigned long end_offset = VM_PAGESIZE - 1;
-		if (i == start_page){
-			sta_offset = (unsigned long)message - page_sta;
-		}
-		if (i == end_page){
-			end_offset = (unsigned long)message - page_sta + len - 1;
-		}
-		unsigned long ppage_addr = info->page_table.ptes[i].ppage * VM_PAGESIZE + (unsigned long)pm_physmem;
-		if(info->page_table.ptes[i].read_enable == 0){
-			vm_fault((void *)page_sta, 0);
+	}
+	// the eviction of the page may still be writing its block, see "concurrency"
+	while (!ei.res && !ei.zero && swap_space.writing(ei.disk_num)) {
+		pthread_cond_wait(&write_done, &pager_lock);
+		ei = info->extra_info[page_number];
+	}
+	trace_event(write_flag ? VM_TRACE_WRITE : VM_TRACE_READ, 0, page_number);
+	if (!ei.res && ei.zero && !write_flag && zero_frame >= 0) {
+		// a read of a never written page shares zero_frame, the first write faults again
+		stat_count(STAT_ZERO_MAP, info);
+		pte->ppage = zero_frame;
+		pte->read_enable = 1;
+		pte->write_enable = 0;
+		return 0;
+	}
+	// the first write makes a zero page a data page, see overcommit
+	bool new_data = write_flag && ei.zero;
+	if (new_data) {
+		if (overcommit_percent && data_pages >= data_page_limit) {
+			stat_count(STAT_FAULT_OOM, info);
+			return -1;
 		}
+		data_pages++;
+	}
+	bool paged_in = !ei.res;
+	if (!ei.res) {
 		
-		memcpy(result+len_cal, (const void*)(ppage_addr+sta_offset),end_offset - sta_offset + 1);
-		len_cal += end_offset - sta_offset + 1;
-		
+		// get a free memory page
+		//     there is free mem
+		//     find a victim, evict it thus get a free mem 
+		// if page-in page's zero bit is set
+		//     fill it with 0
+		// else
+		//     disk read
+		//     add disk_num to temp-map
+		// write free mem to its pte
+		// set res = 1
+		bool unlock = may_unlock && frames_in_flight < (private_pages - 1) / 2;
+		unsigned long write_back = NO_DISK_BLOCK;
+		unsigned long free_page = get_free_frame(unlock ? &write_back : 0);
+		if (free_page == NO_FREE_FRAME) {
+			data_pages -= new_data;
+			stat_count(STAT_FAULT_OOM, info);
+			return -1;
+		}
+
+		unsigned long block = info->extra_info[page_number].disk_num;
+		bool zero = info->extra_info[page_number].zero;
+		if (write_back != NO_DISK_BLOCK && !zero && pool_size && pool_index.count(block)) {
+			// the pool is read under pager_lock, and only after the victim is out of the frame
+			disk_write_timed(write_back, free_page);
+			write_finished(write_back);
+			write_back = NO_DISK_BLOCK;
+		}
+		if (zero && write_back == NO_DISK_BLOCK) {
+			memset((char*)pm_physmem + free_page * VM_PAGESIZE, 0, VM_PAGESIZE);
+			stat_count(STAT_ZERO_FILL, info);
+		} else if (!zero && pool_size && pool_get(block, free_page)) {
+			stat_count(STAT_PAGE_IN, info);
+			set_temp(info, page_number, block);
+		} else if (unlock) {
+			// write-back and read (or zero fill) in progress, see "concurrency"
+			stat_count(zero ? STAT_ZERO_FILL : STAT_PAGE_IN, info);
+			info->extra_info[page_number].res = 1;
+			pte->ppage = free_page;
+			pin_frame(free_page);
+			frames_in_flight++;
+			pthread_mutex_unlock(&pager_lock);
+			if (write_back != NO_DISK_BLOCK) {
+				disk_write_timed(write_back, free_page);
+			}
+			if (zero) {
+				memset(frame_addr(free_page), 0, VM_PAGESIZE);
+			} else {
+				disk_read_timed(block, free_page);
+			}
+			lock_pager();
+			frames_in_flight--;
+			if (write_back != NO_DISK_BLOCK) {
+				write_finished(write_back);
+			}
+			unpin_frame(free_page);
+			pte = pte_of(info, page_number);
+			if (!zero) {
+				set_temp(info, page_number, block);
+			}
+		} else {
+			stat_count(STAT_PAGE_IN, info);
+			set_temp(info, page_number, block);
+			disk_read_timed(block, free_page);
+		}
+		pte->ppage = free_page;
+		frame_resident(free_page, vpi);
+
+	} else if (write_flag && frame_table[pte->ppage].shared) {
+		// copy-on-write: the page leaves the shared frame for a private copy
+		unsigned int shared = pte->ppage;
+		pin_frame(shared);
+		unsigned long free_page = get_free_frame();
+		unpin_frame(shared);
+		if (free_page == NO_FREE_FRAME) {
+			data_pages -= new_data;
+			stat_count(STAT_FAULT_OOM, info);
+			return -1;
+		}
+		memcpy(frame_addr(free_page), frame_addr(shared), VM_PAGESIZE);
+		drop_sharer(shared, vpi);
+		pte->ppage = free_page;
+		frame_resident(free_page, vpi);
+		ksm_stats.cow++;
+		stat_count(STAT_COW, info);
+
+	} else {
+		if (frame_table[pte->ppage].prefetched) {
+			frame_table[pte->ppage].prefetched = 0;
+			readahead_stats.hits++;
+		}
+		replacement_policy->page_referenced(pte->ppage);
+
+	}
+	ei = info->extra_info[page_number];
+	frame_info *fi = &frame_table[pte->ppage];
+	fi->ref = 1;
+	if (write_flag) {
+		page_extra_info new_ei = {1,1,0,0,ei.advice,ei.ws_window,ei.disk_num};
+		fi->dirt = 1;
+		pte->write_enable = 1;
+		pte->read_enable = 1;
+
+		drop_temp(info, page_number);
+		info->extra_info[page_number] = new_ei;
+
+	} else {
+		page_extra_info new_ei = {1,1,ei.zero,ei.temped,ei.advice,ei.ws_window,ei.disk_num};
+		pte->read_enable = 1;
+		info->extra_info[page_number] = new_ei;
+	}
+
+	if (paged_in) {
+		read_ahead(info, page_number);
 	}
-	cout<<"syslog \t\t\t"<<result<<endl;
-	free(result);
 	return 0;
 }
+
+int 
+vm_fault(void *addr, bool write_flag)
+{
+	Pager_lock lock(current_info);
+	stats_poll();
+	return fault_page(addr, write_flag, true);
+}
+/**********
+vm_syslog(message, len)
+	fail if len is 0 or the message is not inside the valid part of the arena (holes included)
+	log "syslog \t\t\t", the message up to its first NUL byte, and a newline
+	fault in and pin every page the message spans up to the one with the first NUL (Syslog_pages),
+	then let go of pager_lock, reserve room for the line in log_ring, copy the spans into the
+	record and publish it for the flusher; pager_lock is taken back to unpin.  No page-in or
+	eviction of this process runs while a record is reserved and not yet published
+	fail, after logging the part before it, if a page cannot be faulted in (see overcommit)
+	without a ring, or for a line longer than half the ring or spanning more pages than may be
+	pinned at once, syslog_direct logs it
+**********/
+char syslog_prefix[] = "syslog \t\t\t";
+
+/**********
+Syslog_pages: the pages of a message, faulted in and pinned a batch at a time
+	pin(limit): fault in the next pages and pin their frames, until limit (at most LOG_IOVECS)
+		are pinned or half of the private frames are (after at least one), adding the span of
+		each page to spans[1..pinned]; spans[0] is left free for log_write, and the slot after
+		the last span for the newline.  The message is done after the page holding its first
+		NUL and after its last page, or at a page that cannot be faulted in (see overcommit),
+		which makes result -1
+	unpin(): let go of the frames pinned so far and empty spans
+	nothing is allocated, vm_syslog keeps it on the stack
+**********/
+class Syslog_pages{
+	proc_vm_info *info;
+	unsigned long start, last;	// arena offsets of the first and last byte
+	unsigned long page;	// the next page to pin
+	unsigned int frames[LOG_IOVECS];
+public:
+	struct iovec spans[LOG_IOVECS + 2];
+	unsigned int pinned;
+	bool done;
+	int result;
+
+	Syslog_pages(proc_vm_info *info, unsigned long start, unsigned int len)
+		: info(info), start(start), last(start + len - 1), page(start / VM_PAGESIZE), pinned(0),
+		done(false), result(0) {}
+
+	unsigned long count() {
+		return last / VM_PAGESIZE - start / VM_PAGESIZE + 1;
+	}
+
+	void pin(unsigned int limit) {
+		limit = min(limit, (unsigned int)LOG_IOVECS);
+		while (!done && pinned < limit && !(pinned && pinned_frames >= private_pages / 2)) {
+			if (!pte_of(info, page)->read_enable
+				&& fault_page((char *)VM_ARENA_BASEADDR + page * VM_PAGESIZE, 0, false)) {
+				result = -1;
+				done = true;
+				break;
+			}
+			unsigned int frame = pte_of(info, page)->ppage;
+			pin_frame(frame);
+			frames[pinned++] = frame;
+			// the span of the page: [from, to)
+			unsigned long from = page == start / VM_PAGESIZE ? start % VM_PAGESIZE : 0;
+			unsigned long to = page == last / VM_PAGESIZE ? last % VM_PAGESIZE + 1 : VM_PAGESIZE;
+			struct iovec *span = &spans[pinned];
+			span->iov_base = frame_addr(frame) + from;
+			span->iov_len = to - from;
+			char *nul = (char *)memchr(span->iov_base, 0, span->iov_len);
+			if (nul) {
+				span->iov_len = nul - (char *)span->iov_base;
+			}
+			done = nul || page == last / VM_PAGESIZE;
+			page++;
+		}
+	}
+
+	void unpin() {
+		while (pinned) {
+			unpin_frame(frames[--pinned]);
+		}
+	}
+};
+
+/**********
+syslog_direct(lock, pages): log the line from the frames, after everything logged before it
+	the spans of up to LOG_IOVECS pinned pages at a time are copied into log_buffer, or go to
+	writev straight from pm_physmem behind the buffered bytes when they do not fit (log_write)
+	pager_lock is let go while it waits for the flusher and while it writes, log_write_lock
+	(taken before pager_lock) keeps other lines out of the middle of this one
+**********/
+int
+syslog_direct(Pager_lock &lock, Syslog_pages &pages)
+{
+	static char newline[] = "\n";
+	char head[LOG_STAMP_SIZE + sizeof(syslog_prefix)];
+	struct iovec iov[2];
+	lock.drop();
+	log_flush();
+	pthread_mutex_lock(&log_write_lock);
+	int n = log_stamp ? log_format_stamp(head, log_now(), current_pid) : 0;
+	memcpy(head + n, syslog_prefix, sizeof(syslog_prefix) - 1);
+	iov[1].iov_base = head;
+	iov[1].iov_len = n + sizeof(syslog_prefix) - 1;
+	if (!log_append(iov, 2)) {
+		log_write(iov, 2);
+	}
+	lock.retake();
+	do {
+		pages.pin(LOG_IOVECS);
+		int count = pages.pinned + 1;
+		if (pages.done) {
+			pages.spans[count].iov_base = newline;
+			pages.spans[count++].iov_len = 1;
+		}
+		if (!log_append(pages.spans, count)) {
+			lock.drop();
+			log_write(pages.spans, count);
+			lock.retake();
+		}
+		pages.unpin();
+	} while (!pages.done);
+	pthread_mutex_unlock(&log_write_lock);
+	return pages.result;
+}
+
+int 
+vm_syslog(void *message, unsigned int len)
+{
+	Stat_timer timer(HIST_SYSLOG);
+	Pager_lock lock(current_info);
+	stat_count(STAT_SYSLOG, current_info);
+	unsigned long start = (unsigned long)message - (unsigned long)VM_ARENA_BASEADDR;
+	if (len == 0 || (unsigned long)message < (unsigned long)VM_ARENA_BASEADDR)
+		return -1;
+	unsigned long start_page = start / VM_PAGESIZE;
+	unsigned long end_page = (start + len - 1) / VM_PAGESIZE;
+	proc_vm_info *info = current_info;
+	if ((unsigned long)info->top_virtual_page_num <= end_page)
+		return -1;
+	for (unsigned long i = start_page; i <= end_page; i++) {
+		// vm_release left a hole
+		if (!info->extra_info[i].val)
+			return -1;
+	}
+
+	Syslog_pages pages(info, start, len);
+	unsigned long size = (sizeof(log_record) + sizeof(syslog_prefix) - 1 + len + 1 + 7) & ~7UL;
+	if (!log_flusher_running || size > log_ring_size / 2 || pages.count() > LOG_IOVECS
+			|| pinned_frames + pages.count() > private_pages / 2) {
+		log_stats.records++;
+		return syslog_direct(lock, pages);
+	}
+	pages.pin(pages.count());
+	if (!pages.done) {
+		// other threads hold pins too: write it a batch at a time
+		log_stats.records++;
+		return syslog_direct(lock, pages);
+	}
+	lock.drop();
+	log_record *r = log_reserve(size);
+	if (!r) {
+		lock.retake();
+		pages.unpin();
+		log_stats.dropped_records++;
+		log_stats.dropped_bytes += len;
+		return 0;
+	}
+	char *line = (char *)(r + 1);
+	unsigned int n = sizeof(syslog_prefix) - 1;
+	memcpy(line, syslog_prefix, n);
+	for (unsigned int i = 1; i <= pages.pinned; i++) {
+		memcpy(line + n, pages.spans[i].iov_base, pages.spans[i].iov_len);
+		n += pages.spans[i].iov_len;
+	}
+	line[n++] = '\n';
+	r->len = n;
+	r->pid = current_pid;
+	r->timestamp = log_stamp ? log_now() : 0;
+	log_publish(r, size);
+	lock.retake();
+	pages.unpin();
+	log_stats.records++;
+	log_stats.bytes += n;
+	return pages.result;
+}
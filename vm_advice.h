@@ -0,0 +1,17 @@
+/*
+ * vm_advice.h
+ *
+ * The advice values of vm_advise, shared by the pager (vm_pager.h) and the
+ * applications of the native harness (native/harness.h)
+ */
+
+#ifndef _VM_ADVICE_H_
+#define _VM_ADVICE_H_
+
+#define VM_ADVICE_NORMAL 0
+#define VM_ADVICE_SEQUENTIAL 1
+#define VM_ADVICE_RANDOM 2
+#define VM_ADVICE_WILLNEED 3
+#define VM_ADVICE_DONTNEED 4
+
+#endif /* _VM_ADVICE_H_ */
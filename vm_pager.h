@@ -8,6 +8,7 @@
 #define _VM_PAGER_H_
 
 #include <sys/types.h>
+#include "vm_advice.h"
 
 /*
  * ****************************************************
@@ -37,6 +38,47 @@ extern void vm_init(unsigned int memory_pages, unsigned int disk_blocks);
  */
 extern void vm_create(pid_t pid);
 
+/*
+ * vm_fork
+ *
+ * Called when process "parent" forks a new process with process identifier
+ * "child".  The child starts with a copy of the parent's arena: same valid
+ * pages, same contents.  Pages are shared copy-on-write, so the copy costs
+ * nothing until one of the two processes writes a page.  Like a process from
+ * vm_create, the child only runs when it's switched to via vm_switch().
+ * Should return 0 on success, -1 on failure, e.g., if there is not enough
+ * swap space to back a private copy of every page.
+ */
+extern int vm_fork(pid_t parent, pid_t child);
+
+/*
+ * vm_set_quota
+ *
+ * Sets the resident-set quota of process "pid".  Other processes do not
+ * evict its pages while it holds min_frames or fewer physical pages; once it
+ * holds max_frames it replaces its own pages instead of taking more.  0 means
+ * no limit.  Should return 0 on success, -1 on failure, e.g., if there is no
+ * such process or the minimums of all processes would use up physical memory.
+ */
+extern int vm_set_quota(pid_t pid, unsigned int min_frames, unsigned int max_frames);
+
+/*
+ * vm_working_set
+ *
+ * Returns the estimated number of pages process "pid" has used recently
+ * (sampled from reference bits), or -1 if there is no such process.
+ */
+extern int vm_working_set(pid_t pid);
+
+/*
+ * vm_resident
+ *
+ * Returns the number of physical pages process "pid" holds, the ones its
+ * quota from vm_set_quota() applies to (a page shared with other processes
+ * counts for one of them), or -1 if there is no such process.
+ */
+extern int vm_resident(pid_t pid);
+
 /*
  * vm_switch
  *
@@ -76,6 +118,17 @@ extern void vm_destroy();
  */
 extern void * vm_extend();
 
+/*
+ * vm_extend_n
+ *
+ * Like vm_extend, but declares the lowest "count" invalid virtual pages valid
+ * at once.  It should return the lowest-numbered byte of the first new page.
+ * Either all "count" pages become valid or none do: vm_extend_n should return
+ * NULL on error, e.g., if count is 0 or the disk is out of swap space for
+ * all of them.
+ */
+extern void * vm_extend_n(unsigned int count);
+
 /*
  * vm_syslog
  *
@@ -86,6 +139,34 @@ extern void * vm_extend();
  */
 extern int vm_syslog(void *message, unsigned int len);
 
+/*
+ * vm_release
+ *
+ * A request by current process to give back "npages" pages starting at the
+ * page-aligned address "addr".  The pages become invalid and their physical
+ * pages and disk blocks are freed; if they were the highest valid pages,
+ * the next vm_extend hands them out again.
+ * Should return 0 on success, -1 on failure, e.g., if some page in the range
+ * is not valid.
+ */
+extern int vm_release(void *addr, unsigned int npages);
+
+/*
+ * vm_advise
+ *
+ * A hint from current process about "npages" valid pages starting at the
+ * page-aligned address "addr" (the values are in vm_advice.h):
+ *   VM_ADVICE_NORMAL      no special treatment
+ *   VM_ADVICE_SEQUENTIAL  expect sequential access: read ahead more, and
+ *                         let pages behind the reader go first
+ *   VM_ADVICE_RANDOM      expect random access: do not read ahead
+ *   VM_ADVICE_WILLNEED    the pages will be used soon: read them in now
+ *   VM_ADVICE_DONTNEED    the contents are no longer needed: the pages stay
+ *                         valid but read back as zeros
+ * Should return 0 on success, -1 on failure.
+ */
+extern int vm_advise(void *addr, unsigned int npages, int advice);
+
 
 /*
  * *********************************************
@@ -175,4 +256,18 @@ typedef struct {
  */
 extern page_table_t *page_table_base_register;
 
+/*
+ * vm_mmu_lock, vm_mmu_unlock
+ *
+ * For an MMU serving several threads, each running the process it last
+ * switched to via vm_switch().  vm_mmu_lock returns the page table of the
+ * calling thread's process and keeps the pager from changing its entries
+ * (to evict, share or write-protect one of its pages) until vm_mmu_unlock.
+ * The MMU holds it while it translates an address and accesses the physical
+ * page, and releases it before calling vm_fault or any other pager function.
+ * A single-threaded MMU can read page_table_base_register instead.
+ */
+extern page_table_t *vm_mmu_lock();
+extern void vm_mmu_unlock();
+
 #endif /* _VM_PAGER_H_ */
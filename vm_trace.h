@@ -0,0 +1,58 @@
+/*
+ * vm_trace.h
+ *
+ * Format of the event trace the pager writes when VM_TRACE names a file
+ */
+
+#ifndef _VM_TRACE_H_
+#define _VM_TRACE_H_
+
+/*
+ * A trace is VM_TRACE_MAGIC (8 bytes) followed by vm_trace_record_t
+ * records in the order the pager saw the events.  Virtual page numbers
+ * count from the start of the arena.
+ *
+ *   VM_TRACE_READ, VM_TRACE_WRITE  the current process faulted on page
+ *                                  "value"; only faults are seen, an
+ *                                  access the MMU allowed is not
+ *   VM_TRACE_CREATE                process "value" was created
+ *   VM_TRACE_PARENT                the next VM_TRACE_FORK's parent is
+ *                                  process "value"
+ *   VM_TRACE_FORK                  the process of the VM_TRACE_PARENT
+ *                                  just before forked child "value"
+ *   VM_TRACE_SWITCH                process "value" became current
+ *   VM_TRACE_EXTEND                "count" pages from page "value" of the
+ *                                  current process became valid
+ *   VM_TRACE_RELEASE               "count" pages from page "value" became
+ *                                  invalid (vm_release)
+ *   VM_TRACE_DISCARD               "count" pages from page "value" lost
+ *                                  their contents (VM_ADVICE_DONTNEED)
+ *   VM_TRACE_DESTROY               the current process exited
+ *
+ * When several threads serve faults, the pager writes a VM_TRACE_SWITCH
+ * whenever the process of a record differs from the current one, so each
+ * record still belongs to the process last switched to.  Pids get records
+ * of their own, as "value", since "count" holds only 28 bits.
+ */
+#define VM_TRACE_MAGIC "VMTRACE2"
+
+#define VM_TRACE_READ 0
+#define VM_TRACE_WRITE 1
+#define VM_TRACE_CREATE 2
+#define VM_TRACE_FORK 3
+#define VM_TRACE_SWITCH 4
+#define VM_TRACE_EXTEND 5
+#define VM_TRACE_RELEASE 6
+#define VM_TRACE_DISCARD 7
+#define VM_TRACE_DESTROY 8
+#define VM_TRACE_PARENT 9
+
+typedef struct {
+    unsigned int op;		/* VM_TRACE_* in bits 0-3, count in bits 4-31 */
+    unsigned int value;		/* page number or pid */
+} vm_trace_record_t;
+
+#define VM_TRACE_OP(record) ((record).op & 15)
+#define VM_TRACE_COUNT(record) ((record).op >> 4)
+
+#endif /* _VM_TRACE_H_ */